@@ -0,0 +1,429 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <atomic>
+
+#include "kvstore.h"
+
+/**
+ * db_bench style driver. Logical key i is stored as 2 * i so that
+ * readmissing can ask for the odd keys in between.
+ */
+struct BenchConfig
+{
+	std::string benchmarks = "fillseq,fillrandom,overwrite,readrandom,readmissing,readhot,seekrandom,deleterandom";
+	std::string dir = "./bench-data";
+	std::string json;
+	uint64_t num = 100000;
+	uint64_t reads = 0;
+	uint32_t valueSize = 1000;
+	uint32_t threads = 1;
+	uint32_t scanLength = 100;
+	double zipfTheta = 0.99;
+	uint64_t seed = 301;
+	bool statistics = false;
+	bool pinnedReads = false;
+	CompactionOptions options;
+};
+
+struct BenchResult
+{
+	std::string name;
+	uint64_t ops = 0;
+	uint64_t found = 0;
+	uint64_t bytes = 0;
+	double seconds = 0;
+	std::vector<uint64_t> latencies; // nanoseconds
+};
+
+/**
+ * Zipfian generator over [0, n) as used by YCSB, item 0 is the hottest.
+ */
+class Zipfian
+{
+private:
+	uint64_t n;
+	double theta, alpha, zetan, eta;
+
+	static double zeta(uint64_t n, double theta)
+	{
+		double sum = 0;
+		for (uint64_t i = 1; i <= n; ++i)
+			sum += 1 / std::pow((double)i, theta);
+		return sum;
+	}
+
+public:
+	Zipfian(uint64_t n, double theta) : n(n), theta(theta)
+	{
+		alpha = 1 / (1 - theta);
+		zetan = zeta(n, theta);
+		eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta(2, theta) / zetan);
+	}
+
+	uint64_t next(std::mt19937_64 &rng)
+	{
+		double u = std::uniform_real_distribution<double>(0, 1)(rng);
+		double uz = u * zetan;
+		if (uz < 1)
+			return 0;
+		if (uz < 1 + std::pow(0.5, theta))
+			return 1;
+		return std::min<uint64_t>(n - 1, (uint64_t)(n * std::pow(eta * u - eta + 1, alpha)));
+	}
+};
+
+class Benchmark
+{
+private:
+	BenchConfig config;
+	KVStore store;
+	std::string value;
+	std::atomic<uint64_t> inserted;
+	Zipfian *zipf;
+	// benchmarks run so far, each one draws its own keys
+	uint32_t runs;
+
+	uint64_t key(uint64_t i) { return 2 * i; }
+
+	void read(uint64_t k, BenchResult &result)
+	{
+		if (config.pinnedReads)
+		{
+			PinnableSlice got;
+			if (store.getPinned(k, &got))
+			{
+				++result.found;
+				result.bytes += 8 + got.size();
+			}
+			return;
+		}
+		std::string got = store.get(k);
+		if (!got.empty())
+		{
+			++result.found;
+			result.bytes += 8 + got.size();
+		}
+	}
+
+	void write(uint64_t k, BenchResult &result)
+	{
+		store.put(k, value);
+		result.bytes += 8 + value.size();
+	}
+
+	void scan(uint64_t k, BenchResult &result)
+	{
+		std::list<std::pair<uint64_t, std::string>> list;
+		store.scan(k, k + 2 * config.scanLength - 1, list);
+		result.found += list.size();
+		for (auto it = list.begin(); it != list.end(); ++it)
+			result.bytes += 8 + (*it).second.size();
+	}
+
+	// YCSB D reads recently inserted keys more often than old ones
+	uint64_t latest(std::mt19937_64 &rng)
+	{
+		uint64_t newest = inserted.load();
+		uint64_t back = zipf->next(rng);
+		return back < newest ? newest - 1 - back : 0;
+	}
+
+	void op(const std::string &name, uint64_t i, std::mt19937_64 &rng, BenchResult &result)
+	{
+		uint64_t r = rng() % config.num;
+		uint32_t dice = rng() % 100;
+		if (name == "fillseq")
+			write(key(i), result);
+		else if (name == "fillrandom" || name == "overwrite")
+			write(key(r), result);
+		else if (name == "readrandom")
+			read(key(r), result);
+		else if (name == "readmissing")
+			read(key(r) + 1, result);
+		else if (name == "readhot")
+			read(key(zipf->next(rng)), result);
+		else if (name == "seekrandom")
+			scan(key(r), result);
+		else if (name == "deleterandom")
+			store.del(key(r));
+		else if (name == "ycsba")
+			dice < 50 ? (void)read(key(zipf->next(rng)), result) : write(key(zipf->next(rng)), result);
+		else if (name == "ycsbb")
+			dice < 95 ? (void)read(key(zipf->next(rng)), result) : write(key(zipf->next(rng)), result);
+		else if (name == "ycsbc")
+			read(key(zipf->next(rng)), result);
+		else if (name == "ycsbd")
+			dice < 95 ? (void)read(key(latest(rng)), result) : write(key(inserted++), result);
+		else if (name == "ycsbe")
+			dice < 95 ? scan(key(zipf->next(rng)), result) : write(key(inserted++), result);
+		else if (name == "ycsbf")
+		{
+			uint64_t k = key(zipf->next(rng));
+			read(k, result);
+			if (dice >= 50)
+				write(k, result);
+		}
+	}
+
+	bool isWrite(const std::string &name)
+	{
+		return name == "fillseq" || name == "fillrandom" || name == "overwrite" || name == "deleterandom";
+	}
+
+public:
+	Benchmark(const BenchConfig &config) : config(config), store(config.dir, config.options), value(config.valueSize, 'v'), inserted(config.num), runs(0)
+	{
+		zipf = new Zipfian(config.num, config.zipfTheta);
+	}
+
+	~Benchmark()
+	{
+		delete zipf;
+	}
+
+	std::string stats()
+	{
+		return store.getProperty("stats");
+	}
+
+	bool known(const std::string &name)
+	{
+		static const char *names[] = {"fillseq", "fillrandom", "overwrite", "readrandom", "readmissing", "readhot",
+									  "seekrandom", "deleterandom", "ycsba", "ycsbb", "ycsbc", "ycsbd", "ycsbe", "ycsbf"};
+		return std::find(std::begin(names), std::end(names), name) != std::end(names);
+	}
+
+	BenchResult run(const std::string &name)
+	{
+		if (name == "fillseq" || name == "fillrandom")
+			store.reset();
+		inserted = config.num;
+		uint64_t total = isWrite(name) || config.reads == 0 ? config.num : config.reads;
+		std::vector<BenchResult> results(config.threads);
+		std::vector<std::thread> workers;
+		// reads must not replay the keys the fill before them wrote, only --seed repeats a run
+		uint32_t run = runs++;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (uint32_t t = 0; t < config.threads; ++t)
+		{
+			workers.push_back(std::thread([&, t]() {
+				std::seed_seq seeds{(uint32_t)config.seed, (uint32_t)(config.seed >> 32), run, t};
+				std::mt19937_64 rng(seeds);
+				BenchResult &result = results[t];
+				uint64_t from = total * t / config.threads, to = total * (t + 1) / config.threads;
+				result.latencies.reserve(to - from);
+				for (uint64_t i = from; i < to; ++i)
+				{
+					std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+					op(name, i, rng, result);
+					result.latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+				}
+				result.ops = to - from;
+			}));
+		}
+		for (auto it = workers.begin(); it != workers.end(); ++it)
+			(*it).join();
+		BenchResult merged;
+		merged.name = name;
+		merged.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		for (auto it = results.begin(); it != results.end(); ++it)
+		{
+			merged.ops += (*it).ops;
+			merged.found += (*it).found;
+			merged.bytes += (*it).bytes;
+			merged.latencies.insert(merged.latencies.end(), (*it).latencies.begin(), (*it).latencies.end());
+		}
+		std::sort(merged.latencies.begin(), merged.latencies.end());
+		return merged;
+	}
+};
+
+static double percentile(const std::vector<uint64_t> &sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+	uint64_t pos = std::min<uint64_t>(sorted.size() - 1, (uint64_t)(p / 100 * sorted.size()));
+	return sorted[pos] / 1000.0;
+}
+
+static void printText(const BenchResult &r)
+{
+	double opsPerSec = r.ops / r.seconds;
+	double mbPerSec = r.bytes / 1048576.0 / r.seconds;
+	std::printf("%-12s : %10.3f micros/op %10.0f ops/sec %8.1f MB/s", r.name.c_str(), r.seconds * 1e6 / r.ops, opsPerSec, mbPerSec);
+	if (r.found > 0)
+		std::printf(" (%llu found)", (unsigned long long)r.found);
+	std::printf("\n%-12s   p50 %.2f  p95 %.2f  p99 %.2f  p99.9 %.2f  max %.2f micros\n", "",
+				percentile(r.latencies, 50), percentile(r.latencies, 95), percentile(r.latencies, 99),
+				percentile(r.latencies, 99.9), r.latencies.empty() ? 0 : r.latencies.back() / 1000.0);
+	std::fflush(stdout);
+}
+
+static std::string toJson(const BenchResult &r, const BenchConfig &config)
+{
+	std::ostringstream out;
+	out << "{\"benchmark\":\"" << r.name << "\",\"num\":" << config.num << ",\"value_size\":" << config.valueSize
+		<< ",\"threads\":" << config.threads << ",\"ops\":" << r.ops << ",\"found\":" << r.found
+		<< ",\"seconds\":" << r.seconds << ",\"ops_per_sec\":" << r.ops / r.seconds
+		<< ",\"mb_per_sec\":" << r.bytes / 1048576.0 / r.seconds
+		<< ",\"micros\":{\"p50\":" << percentile(r.latencies, 50) << ",\"p95\":" << percentile(r.latencies, 95)
+		<< ",\"p99\":" << percentile(r.latencies, 99) << ",\"p99.9\":" << percentile(r.latencies, 99.9)
+		<< ",\"max\":" << (r.latencies.empty() ? 0 : r.latencies.back() / 1000.0) << "}}";
+	return out.str();
+}
+
+static void usage(const char *prog)
+{
+	std::cout << "Usage: " << prog << " [--flag=value ...]" << std::endl;
+	std::cout << "  --benchmarks=a,b,...  fillseq fillrandom overwrite readrandom readmissing readhot" << std::endl;
+	std::cout << "                        seekrandom deleterandom ycsba ycsbb ycsbc ycsbd ycsbe ycsbf" << std::endl;
+	std::cout << "  --num=N               keys in the store [100000]" << std::endl;
+	std::cout << "  --reads=N             operations of read workloads, 0 means num [0]" << std::endl;
+	std::cout << "  --value_size=N        bytes per value [1000]" << std::endl;
+	std::cout << "  --threads=N           client threads [1]" << std::endl;
+	std::cout << "  --scan_length=N       keys per seek [100]" << std::endl;
+	std::cout << "  --zipf_theta=X        skew of readhot and ycsb [0.99]" << std::endl;
+	std::cout << "  --seed=N              seed of the keys drawn, the same seed repeats a run [301]" << std::endl;
+	std::cout << "  --db=DIR              data directory [./bench-data]" << std::endl;
+	std::cout << "  --compaction=S        leveled, tiered or lazy [leveled]" << std::endl;
+	std::cout << "  --fanout=N            level size ratio [10]" << std::endl;
+	std::cout << "  --subcompactions=N    threads per compaction [1]" << std::endl;
+	std::cout << "  --direct_writes=0|1   write tables with O_DIRECT [0]" << std::endl;
+	std::cout << "  --bytes_per_sync=N    write back tables every N bytes, 0 only at the end [1048576]" << std::endl;
+	std::cout << "  --memtable_hash_buckets=N  hash index on the memtable, 0 for none [0]" << std::endl;
+	std::cout << "  --row_cache_bytes=N   row cache capacity, 0 for none [0]" << std::endl;
+	std::cout << "  --range_filter_bits=N range filter bits per key of each table, 0 for none [0]" << std::endl;
+	std::cout << "  --index_partition=N   entries per index partition, read through the block cache, 0 for none [0]" << std::endl;
+	std::cout << "  --block_cache_bytes=N block cache capacity for index partitions and unpinned tables [8388608]" << std::endl;
+	std::cout << "  --filter_bits=N       bits per key of a filter sized to each table, 0 for none [0]" << std::endl;
+	std::cout << "  --filter_type=S       bloom or xor, for sized and partition filters [bloom]" << std::endl;
+	std::cout << "  --filter_type_level=N first level using filter_type, Bloom above [0]" << std::endl;
+	std::cout << "  --filter_budget_bytes=N  filter bytes for all keys, split across levels, 0 for none [0]" << std::endl;
+	std::cout << "  --verify_mapped_reads=0|1  check values of gets against their checksums [1]" << std::endl;
+	std::cout << "  --json=FILE           also write the results as JSON, - for stdout" << std::endl;
+	std::cout << "  --statistics=0|1      print the store statistics at the end [0]" << std::endl;
+	std::cout << "  --pinned_reads=0|1    read values without copying them [0]" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	BenchConfig config;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		size_t eq = arg.find('=');
+		if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+		{
+			usage(argv[0]);
+			return 1;
+		}
+		std::string flag = arg.substr(2, eq - 2), val = arg.substr(eq + 1);
+		if (flag == "benchmarks")
+			config.benchmarks = val;
+		else if (flag == "num")
+			config.num = std::stoull(val);
+		else if (flag == "reads")
+			config.reads = std::stoull(val);
+		else if (flag == "value_size")
+			config.valueSize = std::stoul(val);
+		else if (flag == "threads")
+			config.threads = std::max(1ul, std::stoul(val));
+		else if (flag == "scan_length")
+			config.scanLength = std::stoul(val);
+		else if (flag == "zipf_theta")
+			config.zipfTheta = std::stod(val);
+		else if (flag == "seed")
+			config.seed = std::stoull(val);
+		else if (flag == "db")
+			config.dir = val;
+		else if (flag == "json")
+			config.json = val;
+		else if (flag == "statistics")
+			config.statistics = val != "0";
+		else if (flag == "pinned_reads")
+			config.pinnedReads = val != "0";
+		else if (flag == "compaction")
+			config.options.style = val == "tiered" ? TIERED_COMPACTION : val == "lazy" ? LAZY_LEVELED_COMPACTION : LEVELED_COMPACTION;
+		else if (flag == "fanout")
+			config.options.fanout = std::stoul(val);
+		else if (flag == "subcompactions")
+			config.options.subcompactions = std::stoul(val);
+		else if (flag == "direct_writes")
+			config.options.directWrites = val != "0";
+		else if (flag == "bytes_per_sync")
+			config.options.bytesPerSync = std::stoull(val);
+		else if (flag == "memtable_hash_buckets")
+			config.options.memtableHashBuckets = std::stoul(val);
+		else if (flag == "row_cache_bytes")
+			config.options.rowCacheBytes = std::stoull(val);
+		else if (flag == "range_filter_bits")
+			config.options.rangeFilterBitsPerKey = std::stoul(val);
+		else if (flag == "index_partition")
+			config.options.indexPartitionEntries = std::stoul(val);
+		else if (flag == "block_cache_bytes")
+			config.options.blockCacheBytes = std::stoull(val);
+		else if (flag == "filter_bits")
+			config.options.filterBitsPerKey = std::stoul(val);
+		else if (flag == "filter_type")
+			config.options.filterType = val == "xor" ? XOR_FILTER : BLOOM_FILTER;
+		else if (flag == "filter_type_level")
+			config.options.filterTypeLevel = std::stoul(val);
+		else if (flag == "filter_budget_bytes")
+			config.options.filterBudgetBytes = std::stoull(val);
+		else if (flag == "verify_mapped_reads")
+			config.options.verifyMappedReads = val != "0";
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	Benchmark bench(config);
+	std::cout << "Keys:       " << config.num << " (8 bytes each)" << std::endl;
+	std::cout << "Values:     " << config.valueSize << " bytes each" << std::endl;
+	std::cout << "Threads:    " << config.threads << std::endl;
+	std::cout << "------------------------------------------------" << std::endl;
+
+	std::vector<std::string> jsons;
+	std::stringstream names(config.benchmarks);
+	std::string name;
+	while (std::getline(names, name, ','))
+	{
+		if (!bench.known(name))
+		{
+			std::cerr << "Unknown benchmark " << name << std::endl;
+			continue;
+		}
+		BenchResult result = bench.run(name);
+		printText(result);
+		jsons.push_back(toJson(result, config));
+	}
+	if (config.statistics)
+		std::cout << "------------------------------------------------" << std::endl
+				  << bench.stats();
+
+	if (!config.json.empty())
+	{
+		std::ostringstream out;
+		out << "[" << std::endl;
+		for (size_t i = 0; i < jsons.size(); ++i)
+			out << "  " << jsons[i] << (i + 1 < jsons.size() ? "," : "") << std::endl;
+		out << "]" << std::endl;
+		if (config.json == "-")
+			std::cout << out.str();
+		else
+			std::ofstream(config.json) << out.str();
+	}
+	return 0;
+}
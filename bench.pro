@@ -0,0 +1,47 @@
+TEMPLATE = app
+CONFIG += console c++11 thread
+CONFIG -= app_bundle
+CONFIG -= qt
+TARGET = bench
+
+SOURCES += \
+    bench.cc \
+    blockcache.cc \
+    bloomfilter.cpp \
+    compaction.cc \
+    crc32c.cc \
+    eventlistener.cc \
+    filterblock.cc \
+    kvstore.cc\
+    memorybudget.cc \
+    perfcontext.cc \
+    rangefilter.cc \
+    ratelimiter.cc \
+    rowcache.cc \
+    skiplist.cpp \
+    sstable.cpp \
+    statistics.cc \
+    tablebuilder.cc
+
+HEADERS += \
+    blockcache.h \
+    bloomfilter.h \
+    clockcache.h \
+    compaction.h \
+    crc32c.h \
+    eventlistener.h \
+    filterblock.h \
+    kvstore.h\
+    kvstore_api.h\
+    memorybudget.h \
+    MurmurHash3.h\
+    perfcontext.h \
+    pinnableslice.h \
+    rangefilter.h \
+    ratelimiter.h \
+    rowcache.h \
+    skiplist.h \
+    sstable.h \
+    statistics.h \
+    tablebuilder.h \
+    utils.h
@@ -0,0 +1,16 @@
+#include "blockcache.h"
+#include "sstable.h"
+
+BlockCache::BlockCache(uint64_t capacity, MemoryBudget *budget) : ClockCache(capacity, budget)
+{
+}
+
+void BlockCache::insert(uint64_t key, const std::shared_ptr<TableBlocks> &blocks, uint64_t charge)
+{
+    Shard &shard = shards[fmix64(key) % SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    // two readers missed on the same partition, the first one stays
+    if (shard.entries.count(key))
+        return;
+    insertLocked(shard, key, blocks, charge);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "clockcache.h"
+#include <memory>
+
+struct TableBlocks;
+
+/**
+ * Index and filter partitions of tables read on demand, keyed by table
+ * and partition. Sharded with CLOCK eviction like the row cache; an
+ * evicted partition stays valid for the readers still holding it.
+ */
+class BlockCache : public ClockCache<std::shared_ptr<TableBlocks>>
+{
+public:
+	BlockCache(uint64_t capacity, MemoryBudget *budget = nullptr);
+
+	// charge is the bytes the partition holds
+	void insert(uint64_t key, const std::shared_ptr<TableBlocks> &blocks, uint64_t charge);
+};
@@ -1,38 +1,49 @@
-#include "bloomfilter.h"
-
-BloomFilter::BloomFilter()
-{
-    BF.reset();
-}
-
-BloomFilter::BloomFilter(char *buf)
-{
-    memcpy((char *)&BF, buf, 10240);
-}
-
-bool BloomFilter::isExisted(uint64_t key)
-{
-    MurmurHash3_x64_128(&key, sizeof(key), 1, hash);
-    for (int i = 0; i < 4; ++i)
-    {
-        hash[i] %= 81920;
-        if (!BF[hash[i]])
-            return false;
-    }
-    return true;
-}
-
-void BloomFilter::setBF(uint64_t key)
-{
-    MurmurHash3_x64_128(&key, sizeof(key), 1, hash);
-    for (int i = 0; i < 4; ++i)
-    {
-        hash[i] %= 81920;
-        BF[hash[i]] = 1;
-    }
-}
-
-void BloomFilter::saveBuffer(char *buf)
-{
-    memcpy(buf, (char *)&BF, 10240);
-}
+#include "bloomfilter.h"
+
+// MurmurHash3 stores two 64-bit words, copy them out rather than alias them
+static void hashKey(uint64_t key, unsigned int hash[4])
+{
+    uint64_t digest[2];
+    MurmurHash3_x64_128(&key, sizeof(key), 1, digest);
+    memcpy(hash, digest, sizeof(digest));
+}
+
+BloomFilter::BloomFilter()
+{
+    BF.reset();
+}
+
+BloomFilter::BloomFilter(char *buf)
+{
+    memcpy((char *)&BF, buf, 10240);
+}
+
+bool BloomFilter::isExisted(uint64_t key)
+{
+    // hashes live on the stack so concurrent readers can share a filter
+    unsigned int hash[4];
+    hashKey(key, hash);
+    for (int i = 0; i < 4; ++i)
+    {
+        hash[i] %= 81920;
+        if (!BF[hash[i]])
+            return false;
+    }
+    return true;
+}
+
+void BloomFilter::setBF(uint64_t key)
+{
+    unsigned int hash[4];
+    hashKey(key, hash);
+    for (int i = 0; i < 4; ++i)
+    {
+        hash[i] %= 81920;
+        BF[hash[i]] = 1;
+    }
+}
+
+void BloomFilter::saveBuffer(char *buf)
+{
+    memcpy(buf, (char *)&BF, 10240);
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "memorybudget.h"
+#include "MurmurHash3.h"
+#include <cstdint>
+#include <algorithm>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+/**
+ * Values keyed by a 64-bit key, hashed to shards with a lock and a share
+ * of the capacity each. Eviction is CLOCK: entries leave in the order
+ * they came unless read since the hand last passed them, so a hit only
+ * sets a flag. The bytes held are charged to the memory budget as cache;
+ * once the budget has no room left an entry only takes the place of
+ * others.
+ * The row cache and the block cache decide what goes in on top of it.
+ */
+template <typename Value>
+class ClockCache
+{
+protected:
+	static const uint32_t SHARDS = 16;
+	// list and hash nodes around each value
+	static const uint64_t ENTRY_OVERHEAD = 96;
+
+	struct Entry
+	{
+		Value value;
+		uint64_t charge;
+		bool referenced;
+		std::list<uint64_t>::iterator position;
+	};
+
+	typedef typename std::unordered_map<uint64_t, Entry>::iterator EntryIter;
+
+	struct Shard
+	{
+		std::mutex mutex;
+		std::unordered_map<uint64_t, Entry> entries;
+		// keys in the order the clock hand passes them
+		std::list<uint64_t> clock;
+		uint64_t usage;
+	};
+
+	Shard shards[SHARDS];
+	uint64_t capacity;
+	MemoryBudget *budget;
+
+	// with the shard locked
+	void evict(Shard &shard, EntryIter it);
+	// one step of the clock hand with the shard locked, the bytes it freed
+	uint64_t advance(Shard &shard);
+	// with the shard locked and the key not in it, nothing if the entry takes more than the shard's share
+	void insertLocked(Shard &shard, uint64_t key, const Value &value, uint64_t bytes);
+
+public:
+	ClockCache(uint64_t capacity, MemoryBudget *budget);
+	~ClockCache();
+
+	bool lookup(uint64_t key, Value &value);
+	// evict until bytes are freed or nothing is left, the bytes freed
+	uint64_t shed(uint64_t bytes);
+
+	uint64_t getUsage();
+	uint64_t getCapacity() const { return capacity; }
+	uint64_t size();
+};
+
+template <typename Value>
+const uint32_t ClockCache<Value>::SHARDS;
+
+template <typename Value>
+const uint64_t ClockCache<Value>::ENTRY_OVERHEAD;
+
+template <typename Value>
+ClockCache<Value>::ClockCache(uint64_t capacity, MemoryBudget *budget) : capacity(capacity), budget(budget)
+{
+	for (uint32_t i = 0; i < SHARDS; ++i)
+		shards[i].usage = 0;
+}
+
+template <typename Value>
+ClockCache<Value>::~ClockCache()
+{
+	if (budget)
+		budget->release(MEM_CACHE, getUsage());
+}
+
+template <typename Value>
+void ClockCache<Value>::evict(Shard &shard, EntryIter it)
+{
+	shard.usage -= it->second.charge;
+	if (budget)
+		budget->release(MEM_CACHE, it->second.charge);
+	shard.clock.erase(it->second.position);
+	shard.entries.erase(it);
+}
+
+template <typename Value>
+uint64_t ClockCache<Value>::advance(Shard &shard)
+{
+	// entries read since the hand last passed get another round
+	EntryIter victim = shard.entries.find(shard.clock.front());
+	if (victim->second.referenced)
+	{
+		victim->second.referenced = false;
+		shard.clock.splice(shard.clock.end(), shard.clock, shard.clock.begin());
+		return 0;
+	}
+	uint64_t charge = victim->second.charge;
+	evict(shard, victim);
+	return charge;
+}
+
+template <typename Value>
+void ClockCache<Value>::insertLocked(Shard &shard, uint64_t key, const Value &value, uint64_t bytes)
+{
+	uint64_t limit = capacity / SHARDS;
+	uint64_t charge = ENTRY_OVERHEAD + bytes;
+	if (budget && budget->room() < limit - std::min(limit, shard.usage))
+		limit = shard.usage + budget->room();
+	if (charge > limit)
+		return;
+	while (shard.usage + charge > limit)
+		advance(shard);
+	Entry &entry = shard.entries[key];
+	entry.value = value;
+	entry.charge = charge;
+	entry.referenced = false;
+	entry.position = shard.clock.insert(shard.clock.end(), key);
+	shard.usage += charge;
+	if (budget)
+		budget->charge(MEM_CACHE, charge);
+}
+
+template <typename Value>
+bool ClockCache<Value>::lookup(uint64_t key, Value &value)
+{
+	Shard &shard = shards[fmix64(key) % SHARDS];
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	EntryIter it = shard.entries.find(key);
+	if (it == shard.entries.end())
+		return false;
+	it->second.referenced = true;
+	value = it->second.value;
+	return true;
+}
+
+template <typename Value>
+uint64_t ClockCache<Value>::shed(uint64_t bytes)
+{
+	// an even share from each shard first, then whatever the others still hold
+	uint64_t freed = 0;
+	for (uint32_t pass = 0; pass < 2 && freed < bytes; ++pass)
+	{
+		for (uint32_t i = 0; i < SHARDS && freed < bytes; ++i)
+		{
+			Shard &shard = shards[i];
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			uint64_t target = freed + (pass == 0 ? std::min(bytes - freed, (bytes + SHARDS - 1) / SHARDS) : bytes - freed);
+			while (freed < target && !shard.entries.empty())
+				freed += advance(shard);
+		}
+	}
+	return freed;
+}
+
+template <typename Value>
+uint64_t ClockCache<Value>::getUsage()
+{
+	uint64_t usage = 0;
+	for (uint32_t i = 0; i < SHARDS; ++i)
+	{
+		std::lock_guard<std::mutex> lock(shards[i].mutex);
+		usage += shards[i].usage;
+	}
+	return usage;
+}
+
+template <typename Value>
+uint64_t ClockCache<Value>::size()
+{
+	uint64_t count = 0;
+	for (uint32_t i = 0; i < SHARDS; ++i)
+	{
+		std::lock_guard<std::mutex> lock(shards[i].mutex);
+		count += shards[i].entries.size();
+	}
+	return count;
+}
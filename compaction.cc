@@ -0,0 +1,344 @@
+#include "compaction.h"
+#include "kvstore.h"
+#include <set>
+#include <cmath>
+
+std::shared_ptr<CompactionPolicy> CompactionPolicy::create(const CompactionOptions &options)
+{
+    if (options.policy)
+        return options.policy;
+    CompactionOptions checked = options;
+    if (checked.fanout < 2)
+        checked.fanout = 2;
+    if (checked.level0Tables == 0)
+        checked.level0Tables = 1;
+    switch (checked.style)
+    {
+    case TIERED_COMPACTION:
+        return std::make_shared<TieredPolicy>(checked);
+    case LAZY_LEVELED_COMPACTION:
+        return std::make_shared<LazyLeveledPolicy>(checked);
+    default:
+        return std::make_shared<LeveledPolicy>(checked);
+    }
+}
+
+bool LeveledPolicy::pick(const Version &version, CompactionJob &job)
+{
+    const std::vector<std::vector<std::shared_ptr<SSTableCache>>> &cache = version.cache;
+    // always push down from the level furthest over its target
+    double bestScore = 1;
+    int bestLevel = -1;
+    for (uint32_t i = 0; i < cache.size(); ++i)
+    {
+        double score = levelScore(version, i);
+        if (score > bestScore)
+        {
+            bestScore = score;
+            bestLevel = i;
+        }
+    }
+    int seed = -1;
+    if (bestLevel == -1)
+    {
+        // nothing is over its target, collect the garbage of tombstone-dense tables
+        double bestDensity = 0;
+        for (uint32_t i = 1; i < cache.size(); ++i)
+        {
+            int dense = densestTable(cache[i]);
+            if (dense == -1)
+                continue;
+            double density = (double)cache[i][dense]->tombstones / (cache[i][dense]->Header).num;
+            if (density > bestDensity)
+            {
+                bestDensity = density;
+                bestLevel = i;
+                seed = dense;
+            }
+        }
+        if (bestLevel == -1)
+            return false;
+        // the deepest data is rewritten in place, anything above moves down towards it
+        job.sameLevel = true;
+        for (uint32_t i = bestLevel + 1; i < cache.size(); ++i)
+        {
+            if (!cache[i].empty())
+                job.sameLevel = false;
+        }
+    }
+    else
+        seed = pickTable(version, bestLevel);
+
+    // take along every table of the level the key span touches, otherwise an
+    // older version or a tombstone could end up below a newer version
+    const std::vector<std::shared_ptr<SSTableCache>> &tables = cache[bestLevel];
+    std::vector<bool> picked(tables.size(), false);
+    picked[seed] = true;
+    uint64_t lo = (tables[seed]->Header).min, hi = (tables[seed]->Header).max;
+    bool grown = true;
+    while (grown)
+    {
+        grown = false;
+        for (uint32_t i = 0; i < tables.size(); ++i)
+        {
+            if (!picked[i] && (tables[i]->Header).min <= hi && (tables[i]->Header).max >= lo)
+            {
+                picked[i] = true;
+                lo = min(lo, (tables[i]->Header).min);
+                hi = max(hi, (tables[i]->Header).max);
+                grown = true;
+            }
+        }
+    }
+    job.level = bestLevel;
+    job.mergeOutputLevel = true;
+    for (uint32_t i = 0; i < tables.size(); ++i)
+    {
+        if (picked[i])
+            job.inputs.push_back(i);
+    }
+    if (compactPointer.size() <= (uint32_t)bestLevel)
+        compactPointer.resize(bestLevel + 1, 0);
+    compactPointer[bestLevel] = hi + 1;
+    return true;
+}
+
+void LeveledPolicy::reset()
+{
+    compactPointer.clear();
+}
+
+/**
+ * How far the level is over its target, above 1 means it needs compaction.
+ */
+double LeveledPolicy::levelScore(const Version &version, uint32_t level)
+{
+    const std::vector<std::shared_ptr<SSTableCache>> &tables = version.cache[level];
+    if (level == 0)
+        return (double)tables.size() / options.level0Tables;
+    return (double)levelBytes(tables) / levelTarget(options, level);
+}
+
+/**
+ * Choose the table a compaction of the level starts from.
+ */
+uint32_t LeveledPolicy::pickTable(const Version &version, uint32_t level)
+{
+    const std::vector<std::vector<std::shared_ptr<SSTableCache>>> &cache = version.cache;
+    const std::vector<std::shared_ptr<SSTableCache>> &tables = cache[level];
+    uint32_t picked = 0;
+    // level-0 tables overlap each other, the oldest has to go down first
+    if (level == 0)
+        return tables.size() - 1;
+    int dense = densestTable(tables);
+    if (dense != -1)
+        return dense;
+    if (options.pick == PICK_MIN_OVERLAP && level + 1 < cache.size())
+    {
+        double bestRatio = -1;
+        for (uint32_t i = 0; i < tables.size(); ++i)
+        {
+            std::vector<range> tableRange(1, range((tables[i]->Header).min, (tables[i]->Header).max));
+            uint64_t overlap = 0;
+            for (auto it = cache[level + 1].begin(); it != cache[level + 1].end(); ++it)
+            {
+                if (haveIntersection((*it).get(), tableRange))
+                    overlap += (*it)->fileSize;
+            }
+            double ratio = (double)overlap / tables[i]->fileSize;
+            if (bestRatio < 0 || ratio < bestRatio)
+            {
+                bestRatio = ratio;
+                picked = i;
+            }
+        }
+        return picked;
+    }
+    // round-robin over the key space, starting where the last compaction stopped
+    uint64_t pointer = level < compactPointer.size() ? compactPointer[level] : 0;
+    bool found = false;
+    for (uint32_t i = 0; i < tables.size(); ++i)
+    {
+        uint64_t min = (tables[i]->Header).min;
+        if (min >= pointer && (!found || min < (tables[picked]->Header).min))
+        {
+            picked = i;
+            found = true;
+        }
+    }
+    if (!found)
+    {
+        for (uint32_t i = 0; i < tables.size(); ++i)
+        {
+            if ((tables[i]->Header).min < (tables[picked]->Header).min)
+                picked = i;
+        }
+    }
+    return picked;
+}
+
+/**
+ * The table with the largest share of droppable tombstones at or above
+ * tombstoneRatio, or -1.
+ */
+int LeveledPolicy::densestTable(const std::vector<std::shared_ptr<SSTableCache>> &tables)
+{
+    int dense = -1;
+    double bestDensity = 0;
+    if (options.tombstoneRatio <= 0)
+        return -1;
+    for (uint32_t i = 0; i < tables.size(); ++i)
+    {
+        if (tables[i]->tombstones == 0)
+            continue;
+        double density = (double)tables[i]->tombstones / (tables[i]->Header).num;
+        if (density >= options.tombstoneRatio && density > bestDensity)
+        {
+            bestDensity = density;
+            dense = i;
+        }
+    }
+    return dense;
+}
+
+bool TieredPolicy::pick(const Version &version, CompactionJob &job)
+{
+    const std::vector<std::vector<std::shared_ptr<SSTableCache>>> &cache = version.cache;
+    for (uint32_t i = 0; i < cache.size(); ++i)
+    {
+        uint32_t maxRuns = i == 0 ? options.level0Tables : options.fanout - 1;
+        if (runCount(cache[i]) > maxRuns)
+        {
+            job.level = i;
+            job.mergeOutputLevel = false;
+            for (uint32_t j = 0; j < cache[i].size(); ++j)
+                job.inputs.push_back(j);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LazyLeveledPolicy::pick(const Version &version, CompactionJob &job)
+{
+    const std::vector<std::vector<std::shared_ptr<SSTableCache>>> &cache = version.cache;
+    uint32_t last = cache.size() - 1;
+    for (uint32_t i = 0; i < cache.size(); ++i)
+    {
+        if (i == last && last > 0)
+            break;
+        uint32_t maxRuns = i == 0 ? options.level0Tables : options.fanout - 1;
+        if (runCount(cache[i]) > maxRuns)
+        {
+            // the runs are merged into the last level, tiered levels get a new run
+            job.level = i;
+            job.mergeOutputLevel = i + 1 == last;
+            for (uint32_t j = 0; j < cache[i].size(); ++j)
+                job.inputs.push_back(j);
+            return true;
+        }
+    }
+    // a full last level moves down as a whole and becomes a tiered level
+    if (last > 0 && levelBytes(cache[last]) > levelTarget(options, last))
+    {
+        job.level = last;
+        job.mergeOutputLevel = false;
+        for (uint32_t j = 0; j < cache[last].size(); ++j)
+            job.inputs.push_back(j);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Tables written by one compaction share their timestamp, so every distinct
+ * timestamp of a level is a sorted run.
+ */
+uint32_t runCount(const std::vector<std::shared_ptr<SSTableCache>> &tables)
+{
+    std::set<uint64_t> timestamps;
+    for (auto it = tables.begin(); it != tables.end(); ++it)
+        timestamps.insert(((*it)->Header).timestamp);
+    return timestamps.size();
+}
+
+uint64_t levelBytes(const std::vector<std::shared_ptr<SSTableCache>> &tables)
+{
+    uint64_t bytes = 0;
+    for (auto it = tables.begin(); it != tables.end(); ++it)
+        bytes += (*it)->fileSize;
+    return bytes;
+}
+
+uint64_t levelTarget(const CompactionOptions &options, uint32_t level)
+{
+    uint64_t target = options.level1Bytes;
+    for (uint32_t i = 1; i < level; ++i)
+        target *= options.fanout;
+    return target;
+}
+
+/**
+ * Bits per key for the filters of each level, so that budgetBits of
+ * filters waste the fewest reads per lookup, as in Monkey. A lookup
+ * probes every run, so the reads wasted are the false positive rates of
+ * all runs summed; with a rate falling as e^(-c * bits per key) the sum
+ * is least when each level's rate is proportional to the keys in one of
+ * its runs. The deep levels holding most keys get fewer bits per key, the
+ * small upper ones more. A level without keys takes the setting of the
+ * nearest one with keys, every level 10 bits when none has any.
+ */
+std::vector<uint32_t> allocateFilterBits(const std::vector<std::vector<std::shared_ptr<SSTableCache>>> &cache, uint64_t budgetBits,
+                                         FilterType type, uint32_t typeLevel)
+{
+    uint32_t levels = max((uint32_t)cache.size(), (uint32_t)1);
+    std::vector<double> keys(levels, 0), runs(levels, 1), decay(levels);
+    for (uint32_t i = 0; i < cache.size(); ++i)
+    {
+        for (auto it = cache[i].begin(); it != cache[i].end(); ++it)
+            keys[i] += ((*it)->Header).num;
+        runs[i] = max(runCount(cache[i]), (uint32_t)1);
+    }
+    for (uint32_t i = 0; i < levels; ++i)
+        decay[i] = type == XOR_FILTER && i >= typeLevel ? std::log(2.0) / 1.23 : std::log(2.0) * std::log(2.0);
+    // the rate of level i is lambda * keys / (decay * runs), the budget sets lambda
+    auto bitsAt = [&](double logLambda, uint32_t i) {
+        double logRate = logLambda + std::log(keys[i] / (decay[i] * runs[i]));
+        return logRate >= 0 ? 0.0 : -logRate / decay[i];
+    };
+    double lo = -200, hi = 200;
+    for (uint32_t step = 0; step < 100; ++step)
+    {
+        double mid = (lo + hi) / 2, total = 0;
+        for (uint32_t i = 0; i < levels; ++i)
+            total += keys[i] > 0 ? keys[i] * bitsAt(mid, i) : 0;
+        if (total > budgetBits)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    std::vector<uint32_t> bits(levels, 0);
+    for (uint32_t i = 0; i < levels; ++i)
+    {
+        // a table always gets some filter, one bit per key is a 60% rate;
+        // past 32 bits a false positive is rarer than a failed read
+        if (keys[i] > 0)
+            bits[i] = min(max((uint32_t)(bitsAt(hi, i) + 0.5), (uint32_t)1), (uint32_t)32);
+    }
+    for (uint32_t i = 1; i < levels; ++i)
+    {
+        if (bits[i] == 0)
+            bits[i] = bits[i - 1];
+    }
+    for (uint32_t i = levels - 1; i-- > 0;)
+    {
+        if (bits[i] == 0)
+            bits[i] = bits[i + 1];
+    }
+    for (uint32_t i = 0; i < levels; ++i)
+    {
+        if (bits[i] == 0)
+            bits[i] = 10;
+    }
+    return bits;
+}
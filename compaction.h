@@ -0,0 +1,169 @@
+#pragma once
+
+#include "sstable.h"
+#include <memory>
+#include <vector>
+
+struct Version;
+
+enum CompactionStyle
+{
+	LEVELED_COMPACTION = 1,
+	TIERED_COMPACTION,
+	LAZY_LEVELED_COMPACTION
+};
+
+enum FilePick
+{
+	PICK_ROUND_ROBIN = 1,
+	PICK_MIN_OVERLAP
+};
+
+class CompactionPolicy;
+
+/**
+ * Shape of the tree. Level-0 compacts on table count, the byte target of
+ * level-i+1 is fanout times the one of level-i. Tiered levels hold up to
+ * fanout sorted runs before they are merged down.
+ * A custom policy, if set, replaces the built-in one named by style.
+ * The rate limiter, if set, throttles flush and compaction I/O and may be
+ * shared between stores. A compaction is split into up to subcompactions
+ * key ranges merged by parallel threads. Tables whose share of droppable
+ * tombstones reaches tombstoneRatio are compacted first, and even when no
+ * level is over its target (leveled policy only, 0 turns this off).
+ * The memory budget, if set, bounds memtables, filters, indexes and
+ * caches and may be shared between stores like the rate limiter.
+ * Tables are written with direct I/O if directWrites is set and written
+ * back every bytesPerSync bytes while they are built.
+ */
+struct CompactionOptions
+{
+	CompactionStyle style;
+	uint32_t level0Tables;
+	uint64_t level1Bytes;
+	uint32_t fanout;
+	FilePick pick;
+	std::shared_ptr<CompactionPolicy> policy;
+	std::shared_ptr<RateLimiter> rateLimiter;
+	uint32_t subcompactions;
+	double tombstoneRatio;
+	std::shared_ptr<MemoryBudget> memoryBudget;
+	bool directWrites;
+	uint64_t bytesPerSync;
+	// buckets of the hash index on each memtable, 0 for none
+	uint32_t memtableHashBuckets;
+	// capacity of the row cache of each store, 0 for none
+	uint64_t rowCacheBytes;
+	// bits per key of the range filter of each table, 0 for none
+	uint32_t rangeFilterBitsPerKey;
+	// entries per index partition of each table, 0 keeps the index whole;
+	// partitions are read on demand through a block cache of this capacity,
+	// which also keeps the filters and indexes the memory budget unpinned
+	uint32_t indexPartitionEntries;
+	uint32_t partitionFilterBitsPerKey;
+	uint64_t blockCacheBytes;
+	// bits per key of a filter sized to each table's keys, kept in place of
+	// the fixed Bloom filter, 0 for none; its type, used by the levels from
+	// filterTypeLevel down (partition filters too), Bloom above them
+	uint32_t filterBitsPerKey;
+	FilterType filterType;
+	uint32_t filterTypeLevel;
+	// bytes of filters across all tables; when set, each level's bits per
+	// key are tuned to it as the levels grow instead of filterBitsPerKey
+	uint64_t filterBudgetBytes;
+	// whether gets check values served straight from a mapped table, most
+	// of them out of the page cache, against their checksums; blocks read
+	// into memory, values read by scans and compaction and files visited
+	// by the scrubber are checked regardless
+	bool verifyMappedReads;
+	CompactionOptions() : style(LEVELED_COMPACTION), level0Tables(2), level1Bytes(4 * MAX_TABLE_SIZE), fanout(10), pick(PICK_ROUND_ROBIN),
+						  subcompactions(1), tombstoneRatio(0.5), directWrites(false), bytesPerSync(1048576),
+						  memtableHashBuckets(0), rowCacheBytes(0), rangeFilterBitsPerKey(0),
+						  indexPartitionEntries(0), partitionFilterBitsPerKey(10), blockCacheBytes(8 << 20),
+						  filterBitsPerKey(0), filterType(BLOOM_FILTER), filterTypeLevel(0), filterBudgetBytes(0),
+						  verifyMappedReads(true) {}
+};
+
+/**
+ * One merge: the given tables of level are read and written to level+1,
+ * either merged with the tables of level+1 they overlap (leveling) or
+ * added there as a new sorted run (tiering). With sameLevel they are
+ * rewritten into their own level instead, to drop garbage at the bottom.
+ */
+struct CompactionJob
+{
+	uint32_t level;
+	std::vector<uint32_t> inputs;
+	bool mergeOutputLevel;
+	bool sameLevel;
+	CompactionJob() : level(0), mergeOutputLevel(true), sameLevel(false) {}
+};
+
+/**
+ * Decides what to compact next. pick() is called with the write lock held
+ * until it returns false.
+ */
+class CompactionPolicy
+{
+public:
+	virtual ~CompactionPolicy() {}
+	virtual bool pick(const Version &version, CompactionJob &job) = 0;
+	virtual void reset() {}
+	static std::shared_ptr<CompactionPolicy> create(const CompactionOptions &options);
+};
+
+/**
+ * One sorted run per level, a single table plus what it overlaps is
+ * pushed down at a time. Lowest read cost, highest write amplification.
+ */
+class LeveledPolicy : public CompactionPolicy
+{
+private:
+	CompactionOptions options;
+	std::vector<uint64_t> compactPointer;
+
+	double levelScore(const Version &version, uint32_t level);
+	uint32_t pickTable(const Version &version, uint32_t level);
+	int densestTable(const std::vector<std::shared_ptr<SSTableCache>> &tables);
+
+public:
+	LeveledPolicy(const CompactionOptions &options) : options(options) {}
+	bool pick(const Version &version, CompactionJob &job) override;
+	void reset() override;
+};
+
+/**
+ * Every level collects sorted runs, once it has too many of them they are
+ * merged into a single new run of the next level. Each entry is rewritten
+ * about once per level, reads may have to look at every run.
+ */
+class TieredPolicy : public CompactionPolicy
+{
+private:
+	CompactionOptions options;
+
+public:
+	TieredPolicy(const CompactionOptions &options) : options(options) {}
+	bool pick(const Version &version, CompactionJob &job) override;
+};
+
+/**
+ * Tiering in the upper levels and leveling in the last one, which holds
+ * most of the data. Writes cost close to tiering, point reads close to
+ * leveling since the largest level is a single run.
+ */
+class LazyLeveledPolicy : public CompactionPolicy
+{
+private:
+	CompactionOptions options;
+
+public:
+	LazyLeveledPolicy(const CompactionOptions &options) : options(options) {}
+	bool pick(const Version &version, CompactionJob &job) override;
+};
+
+uint32_t runCount(const std::vector<std::shared_ptr<SSTableCache>> &tables);
+uint64_t levelBytes(const std::vector<std::shared_ptr<SSTableCache>> &tables);
+uint64_t levelTarget(const CompactionOptions &options, uint32_t level);
+std::vector<uint32_t> allocateFilterBits(const std::vector<std::vector<std::shared_ptr<SSTableCache>>> &cache, uint64_t budgetBits,
+										 FilterType type = BLOOM_FILTER, uint32_t typeLevel = 0);
@@ -1,14 +1,21 @@
 #include <iostream>
 #include <cstdint>
 #include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
 
 #include "test.h"
+#include "shardedkvstore.h"
+#include "crc32c.h"
+#include "utils.h"
 
 class CorrectnessTest : public Test
 {
 private:
 	const uint64_t SIMPLE_TEST_MAX = 512;
     const uint64_t LARGE_TEST_MAX = 1024 * 64; // 1024 * 64
+	const uint64_t RANGE_TEST_MAX = 1024 * 8;
 
 	void regular_test(uint64_t max)
 	{
@@ -86,6 +93,1112 @@ private:
 		report();
 	}
 
+	void range_delete_test(uint64_t max)
+	{
+		uint64_t i;
+
+		// Test a range deletion across sstables
+		for (i = 0; i < max; ++i)
+			store.put(i, std::string(1024, 'r'));
+		store.deleteRange(max / 4, max / 2 - 1);
+
+		for (i = 0; i < max; ++i)
+			EXPECT((i >= max / 4 && i < max / 2) ? not_found : std::string(1024, 'r'),
+				   store.get(i));
+
+		phase();
+
+		// Test newer writes inside a deleted range
+		store.put(max / 4, "SE");
+		EXPECT("SE", store.get(max / 4));
+
+		std::list<std::pair<uint64_t, std::string>> list_stu;
+		store.scan(0, max - 1, list_stu);
+		EXPECT(max - max / 4 + 1, list_stu.size());
+		for (auto sp = list_stu.begin(); sp != list_stu.end(); ++sp)
+			EXPECT(true, (*sp).first < max / 4 || (*sp).first >= max / 2 || (*sp).second == "SE");
+
+		phase();
+
+		// Test range tombstones after compaction
+		for (i = max; i < 2 * max; ++i)
+			store.put(i, std::string(1024, 'x'));
+
+		for (i = 0; i < max; ++i)
+			EXPECT((i > max / 4 && i < max / 2) ? not_found : (i == max / 4 ? "SE" : std::string(1024, 'r')),
+				   store.get(i));
+
+		phase();
+
+		report();
+	}
+
+	void snapshot_test(uint64_t max)
+	{
+		uint64_t i;
+
+		for (i = 0; i < max; ++i)
+			store.put(i, std::string(1024, 'a'));
+		const Snapshot *snapshot = store.getSnapshot();
+
+		// Test writes made after the snapshot
+		for (i = 0; i < max; i += 2)
+			store.put(i, std::string(1024, 'b'));
+		for (i = 1; i < max; i += 4)
+			store.del(i);
+		store.deleteRange(max / 2, max - 1);
+
+		for (i = 0; i < max; ++i)
+		{
+			EXPECT(std::string(1024, 'a'), store.get(i, snapshot));
+			EXPECT(i >= max / 2 ? not_found : (i & 1) == 0 ? std::string(1024, 'b') : (i & 3) == 1 ? not_found : std::string(1024, 'a'),
+				   store.get(i));
+		}
+
+		phase();
+
+		// Test the snapshot after flushes and compactions
+		for (i = max; i < 3 * max; ++i)
+			store.put(i, std::string(1024, 'x'));
+
+		for (i = 0; i < max; ++i)
+			EXPECT(std::string(1024, 'a'), store.get(i, snapshot));
+
+		std::list<std::pair<uint64_t, std::string>> list_stu;
+		store.scan(0, max - 1, list_stu, snapshot);
+		EXPECT(max, list_stu.size());
+
+		phase();
+
+		// Test after the snapshot is released
+		store.releaseSnapshot(snapshot);
+		for (i = 3 * max; i < 5 * max; ++i)
+			store.put(i, std::string(1024, 'y'));
+
+		list_stu.clear();
+		store.scan(0, max - 1, list_stu);
+		EXPECT(max / 2 - max / 8, list_stu.size());
+
+		phase();
+
+		report();
+	}
+
+	void tombstone_test(uint64_t max)
+	{
+		uint64_t i;
+
+		for (i = 0; i < max; ++i)
+			store.put(i, std::string(1024, 't'));
+		const Snapshot *snapshot = store.getSnapshot();
+		for (i = 0; i < max; ++i)
+		{
+			if (i % 4 != 0)
+				store.del(i);
+		}
+
+		// Test tombstones reaching the bottom while a snapshot needs what they hide
+		for (i = max; i < 4 * max; ++i)
+			store.put(i, std::string(1024, 'f'));
+		for (i = 0; i < max; ++i)
+		{
+			EXPECT(std::string(1024, 't'), store.get(i, snapshot));
+			EXPECT(i % 4 == 0 ? std::string(1024, 't') : not_found, store.get(i));
+		}
+		phase();
+
+		// Test nothing deleted comes back once the tombstones are dropped
+		store.releaseSnapshot(snapshot);
+		for (i = 4 * max; i < 7 * max; ++i)
+			store.put(i, std::string(1024, 'g'));
+		for (i = 0; i < max; ++i)
+			EXPECT(i % 4 == 0 ? std::string(1024, 't') : not_found, store.get(i));
+		std::list<std::pair<uint64_t, std::string>> list_stu;
+		store.scan(0, max - 1, list_stu);
+		EXPECT(max / 4, list_stu.size());
+
+		phase();
+
+		report();
+	}
+
+	void concurrent_test(uint64_t max)
+	{
+		uint64_t i;
+		const int readers = 4;
+		std::atomic<uint64_t> nr_reads(0), nr_bad_reads(0);
+		std::atomic<bool> done(false);
+
+		for (i = 0; i < max; ++i)
+			store.put(i, std::string(1024, 'c'));
+
+		// Test readers running alongside flushes and compactions
+		std::vector<std::thread> threads;
+		for (int t = 0; t < readers; ++t)
+		{
+			threads.emplace_back([&, t]() {
+				uint64_t key = t;
+				while (!done)
+				{
+					key = (key * 7 + 13) % max;
+					if (store.get(key) != std::string(1024, 'c'))
+						++nr_bad_reads;
+					++nr_reads;
+				}
+			});
+		}
+		for (i = max; i < 4 * max; ++i)
+			store.put(i, std::string(1024, 'w'));
+		done = true;
+		for (auto &thread : threads)
+			thread.join();
+
+		EXPECT(true, nr_reads > 0);
+		EXPECT((uint64_t)0, nr_bad_reads.load());
+
+		phase();
+
+		report();
+	}
+
+	void compaction_test(uint64_t max, CompactionStyle style)
+	{
+		uint64_t i;
+		CompactionOptions options;
+		options.style = style;
+		options.level1Bytes = 2 * MAX_TABLE_SIZE;
+		options.fanout = 3;
+		options.pick = PICK_MIN_OVERLAP;
+		options.subcompactions = 3;
+		KVStore custom("./data-compaction-" + std::to_string(style), options);
+		custom.reset();
+
+		// Test overwrites in scattered order pushed through several levels
+		for (i = 0; i < max; ++i)
+			custom.put((i * 7919) % max, std::string(1024, 'a'));
+		for (i = 0; i < max; i += 3)
+			custom.put(i, std::string(512, 'b'));
+		for (i = 0; i < max; ++i)
+			EXPECT(std::string(i % 3 == 0 ? 512 : 1024, i % 3 == 0 ? 'b' : 'a'), custom.get(i));
+		phase();
+
+		// Test deletions and range deletions after partial compactions
+		for (i = 1; i < max; i += 3)
+			EXPECT(true, custom.del(i));
+		custom.deleteRange(max / 2, max / 2 + max / 8);
+		for (i = 0; i < max; ++i)
+			custom.put(max + i, std::string(1024, 'c'));
+		for (i = 0; i < max; ++i)
+		{
+			bool gone = i % 3 == 1 || (i >= max / 2 && i <= max / 2 + max / 8);
+			EXPECT(gone ? not_found : std::string(i % 3 == 0 ? 512 : 1024, i % 3 == 0 ? 'b' : 'a'), custom.get(i));
+		}
+
+		phase();
+
+		custom.reset();
+
+		report();
+	}
+
+	void subcompaction_test(uint64_t max, uint32_t rounds)
+	{
+		uint64_t i;
+		CompactionOptions options;
+		options.level1Bytes = 2 * MAX_TABLE_SIZE;
+		options.fanout = 3;
+		options.subcompactions = 4;
+		{
+			KVStore parallel("./data-subcompaction", options);
+			parallel.reset();
+
+			// Test workers writing into one level never share an output table
+			for (uint32_t round = 0; round < rounds; ++round)
+			{
+				for (i = 0; i < max; ++i)
+					parallel.put((i * 7919) % max, std::string(512 + round, 'a' + round));
+			}
+			for (i = 0; i < max; ++i)
+				EXPECT(std::string(512 + rounds - 1, 'a' + rounds - 1), parallel.get(i));
+			EXPECT((uint32_t)0, parallel.scrub(UINT32_MAX));
+			phase();
+		}
+		{
+			KVStore parallel("./data-subcompaction", options);
+			for (i = 0; i < max; ++i)
+				EXPECT(std::string(512 + rounds - 1, 'a' + rounds - 1), parallel.get(i));
+			phase();
+
+			parallel.reset();
+		}
+
+		report();
+	}
+
+	void rate_limit_test(uint64_t max)
+	{
+		uint64_t i;
+		std::shared_ptr<RateLimiter> limiter = std::make_shared<RateLimiter>(8 * 1024 * 1024);
+
+		// Test the bucket holds back a request larger than its rate allows
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		limiter->request(2 * 1024 * 1024, IO_LOW);
+		int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		EXPECT(true, elapsed >= 200);
+		phase();
+
+		// Test a request waiting while the rate is lowered is still granted
+		{
+			std::shared_ptr<RateLimiter> lowered = std::make_shared<RateLimiter>(8 * 1024 * 1024);
+			std::atomic<bool> granted(false);
+			std::thread waiter([&]() {
+				lowered->request(2 * 1024 * 1024, IO_LOW);
+				granted = true;
+			});
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			lowered->setBytesPerSecond(1024 * 1024);
+			for (i = 0; i < 100 && !granted; ++i)
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			EXPECT(true, granted.load());
+			// switched off, a request that hangs anyway is let go
+			lowered->setBytesPerSecond(0);
+			waiter.join();
+		}
+		phase();
+
+		// Test flushes and compactions going through a shared limiter
+		limiter->setBytesPerSecond(256 * 1024 * 1024);
+		CompactionOptions options;
+		options.rateLimiter = limiter;
+		KVStore limited("./data-limited", options);
+		limited.reset();
+		for (i = 0; i < max; ++i)
+			limited.put(i, std::string(1024, 'r'));
+		for (i = 0; i < max; ++i)
+			EXPECT(std::string(1024, 'r'), limited.get(i));
+		EXPECT(true, limiter->getTotalBytes(IO_HIGH) > 0);
+		EXPECT(true, limiter->getTotalBytes(IO_LOW) > 0);
+
+		phase();
+
+		limited.reset();
+
+		report();
+	}
+
+	void sharded_test(uint64_t max, ShardPartition partition)
+	{
+		uint64_t i;
+		ShardedKVStore sharded("./data-sharded-" + std::to_string(partition), 4, partition);
+		sharded.reset();
+
+		// Test keys routed over all shards
+		for (i = 0; i < max; ++i)
+			sharded.put(i, std::string(i % 64 + 1, 's'));
+		for (i = 0; i < max; ++i)
+			EXPECT(std::string(i % 64 + 1, 's'), sharded.get(i));
+		phase();
+
+		// Test deletions and range deletions across shard boundaries
+		for (i = 0; i < max; i += 2)
+			EXPECT(true, sharded.del(i));
+		sharded.deleteRange(max / 4, max / 2);
+		for (i = 0; i < max; ++i)
+			EXPECT((i & 1) && (i < max / 4 || i > max / 2) ? std::string(i % 64 + 1, 's') : not_found,
+				   sharded.get(i));
+		phase();
+
+		// Test merged scan
+		std::list<std::pair<uint64_t, std::string>> list;
+		sharded.scan(0, max - 1, list);
+		uint64_t expected = 0;
+		for (i = 1; i < max; i += 2)
+			if (i < max / 4 || i > max / 2)
+				++expected;
+		EXPECT(expected, (uint64_t)list.size());
+		bool sorted = true;
+		for (auto it = list.begin(); it != list.end() && std::next(it) != list.end(); ++it)
+			if (it->first >= std::next(it)->first)
+				sorted = false;
+		EXPECT(true, sorted);
+
+		phase();
+
+		sharded.reset();
+
+		report();
+	}
+
+	void statistics_test(uint64_t max)
+	{
+		uint64_t i;
+		KVStore counted("./data-statistics");
+		counted.reset();
+		Statistics *stats = counted.getStatistics();
+		stats->reset();
+
+		// Test writes and flushes being counted
+		for (i = 0; i < max; ++i)
+			counted.put(2 * i, std::string(1024, 'c'));
+		EXPECT(max, stats->getTickerCount(KEYS_WRITTEN));
+		EXPECT(max * (8 + 1024), stats->getTickerCount(BYTES_WRITTEN));
+		EXPECT(true, stats->getTickerCount(FLUSH_COUNT) > 0);
+		EXPECT(true, stats->getTickerCount(FLUSH_BYTES_WRITTEN) > 0);
+		EXPECT(max, stats->getHistogramData(PUT_LATENCY).count);
+		phase();
+
+		// Test every get is either a hit of one level or a miss, odd keys
+		// fall inside the tables and have to be turned away by the filters
+		for (i = 0; i < 2 * max; ++i)
+			EXPECT((i & 1) ? not_found : std::string(1024, 'c'), counted.get(i));
+		uint64_t hits = stats->getTickerCount(GET_HIT_MEMTABLE);
+		for (i = 0; i < STATS_LEVELS; ++i)
+			hits += stats->getTickerCount((Ticker)(GET_HIT_L0 + i));
+		EXPECT(max, hits);
+		EXPECT(max, stats->getTickerCount(GET_MISS));
+		EXPECT(true, stats->getTickerCount(BLOOM_USEFUL) > 0);
+		HistogramData get = stats->getHistogramData(GET_LATENCY);
+		EXPECT(2 * max, get.count);
+		EXPECT(true, get.p50 <= get.p99 && get.p99 <= get.max);
+		phase();
+
+		// Test the stats property
+		std::string property = counted.getProperty("stats");
+		EXPECT(true, property.find("write amplification") != std::string::npos);
+		EXPECT(true, property.find("get.hit.memtable") != std::string::npos);
+		EXPECT(std::string(), counted.getProperty("no-such-property"));
+
+		phase();
+
+		counted.reset();
+
+		report();
+	}
+
+	void perf_context_test(uint64_t max)
+	{
+		uint64_t i;
+		KVStore traced("./data-perf");
+		traced.reset();
+		for (i = 0; i < max; ++i)
+			traced.put(2 * i, std::string(1024, 'p'));
+		PerfContext *context = getPerfContext();
+
+		// Test nothing is recorded while disabled
+		setPerfLevel(PERF_DISABLED);
+		context->reset();
+		EXPECT(std::string(1024, 'p'), traced.get(0));
+		EXPECT((uint64_t)0, context->filterProbes + context->indexSteps + context->reads);
+		phase();
+
+		// Test a get served by a table and one turned away by its filter
+		setPerfLevel(PERF_ENABLE_COUNT);
+		context->reset();
+		EXPECT(std::string(1024, 'p'), traced.get(0));
+		uint64_t visited = 0;
+		for (i = 0; i < STATS_LEVELS; ++i)
+			visited += context->tablesVisited[i];
+		EXPECT(true, visited > 0);
+		EXPECT(true, context->filterProbes > 0 && context->indexSteps > 0);
+		EXPECT((uint64_t)1, context->reads);
+		EXPECT((uint64_t)1024, context->bytesRead);
+		EXPECT((uint64_t)0, context->fileOpenNanos);
+		context->reset();
+		EXPECT(not_found, traced.get(1));
+		EXPECT((uint64_t)0, context->reads);
+		EXPECT(true, context->filterRejections > 0);
+		phase();
+
+		// Test timings of a scan
+		setPerfLevel(PERF_ENABLE_TIME);
+		context->reset();
+		std::list<std::pair<uint64_t, std::string>> list;
+		traced.scan(0, 2 * max, list);
+		EXPECT(max, (uint64_t)list.size());
+		EXPECT(true, context->reads > 0);
+		EXPECT(context->reads * 1024, context->bytesRead);
+		EXPECT(true, context->fileOpenNanos > 0 && context->readNanos > 0);
+
+		phase();
+
+		setPerfLevel(PERF_DISABLED);
+		traced.reset();
+
+		report();
+	}
+
+	class RecordingListener : public EventListener
+	{
+	public:
+		std::mutex mutex;
+		std::thread::id caller;
+		bool offThread = true;
+		uint64_t flushBegins = 0, flushes = 0, compactionBegins = 0, compactions = 0, stalls = 0, resumes = 0;
+		bool outputsKnown = true;
+		std::set<std::string> files, corrupted;
+
+		void seen()
+		{
+			if (std::this_thread::get_id() == caller)
+				offThread = false;
+		}
+		void onFlushBegin(const FlushJobInfo &) override
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			seen();
+			++flushBegins;
+		}
+		void onFlushCompleted(const FlushJobInfo &info) override
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			seen();
+			++flushes;
+			outputsKnown = outputsKnown && !info.path.empty() && info.fileSize > 0;
+		}
+		void onCompactionBegin(const CompactionJobInfo &) override
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			++compactionBegins;
+		}
+		void onCompactionCompleted(const CompactionJobInfo &info) override
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			++compactions;
+			outputsKnown = outputsKnown && !info.inputFiles.empty() && !info.outputFiles.empty();
+		}
+		void onTableFileCreated(const TableFileInfo &info) override
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			files.insert(info.path);
+		}
+		void onTableFileDeleted(const TableFileInfo &info) override
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			files.erase(info.path);
+		}
+		void onTableFileCorrupted(const TableFileInfo &info) override
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			corrupted.insert(info.path);
+		}
+		void onStallConditionsChanged(const WriteStallInfo &info) override
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			info.condition == STALL_STOPPED ? ++stalls : ++resumes;
+		}
+	};
+
+	void event_listener_test(uint64_t max)
+	{
+		uint64_t i;
+		std::shared_ptr<RecordingListener> listener = std::make_shared<RecordingListener>();
+		listener->caller = std::this_thread::get_id();
+		{
+			KVStore observed("./data-events");
+			observed.reset();
+			observed.addListener(listener);
+			for (i = 0; i < max; ++i)
+				observed.put(i, std::string(1024, 'e'));
+			observed.deleteRange(0, max / 2);
+			observed.reset();
+		}
+
+		// Test every job reported its begin and end on the listener thread
+		EXPECT(true, listener->flushes > 0);
+		EXPECT(listener->flushBegins, listener->flushes);
+		EXPECT(true, listener->compactions > 0);
+		EXPECT(listener->compactionBegins, listener->compactions);
+		EXPECT(true, listener->outputsKnown);
+		EXPECT(true, listener->offThread);
+		phase();
+
+		// Test stalls come in pairs and every created file was deleted again
+		EXPECT(true, listener->stalls > 0);
+		EXPECT(listener->stalls, listener->resumes);
+		EXPECT((size_t)0, listener->files.size());
+
+		phase();
+
+		report();
+	}
+
+	void memory_budget_test(uint64_t max)
+	{
+		uint64_t i;
+		std::shared_ptr<MemoryBudget> budget = std::make_shared<MemoryBudget>();
+		CompactionOptions options;
+		options.memoryBudget = budget;
+		{
+			KVStore bounded("./data-memory", options);
+			bounded.reset();
+			Statistics *stats = bounded.getStatistics();
+
+			// Test the memtable, filters and indexes being accounted
+			for (i = 0; i < max; ++i)
+				bounded.put(i, std::string(1024, 'm'));
+			EXPECT(true, budget->getUsage(MEM_MEMTABLE) > 0);
+			EXPECT(true, budget->getUsage(MEM_FILTER) > 0);
+			EXPECT((uint64_t)0, budget->getUsage(MEM_FILTER) % sizeof(BloomFilter));
+			EXPECT(true, budget->getUsage(MEM_INDEX) > 0);
+			EXPECT(budget->getTotal(), budget->getUsage(MEM_MEMTABLE) + budget->getUsage(MEM_INDEX) + budget->getUsage(MEM_FILTER));
+			EXPECT(true, bounded.getProperty("memory").find("Pinned") != std::string::npos);
+			phase();
+
+			// Test a tight limit unpins blocks and flushes the memtable early
+			uint64_t limit = 128 * 1024;
+			uint64_t flushes = stats->getTickerCount(FLUSH_COUNT);
+			budget->setLimit(limit);
+			for (i = 0; i < max; ++i)
+				bounded.put(i, std::string(1024, 'n'));
+			EXPECT(true, stats->getTickerCount(FLUSH_COUNT) - flushes > 2 * max * 1024 / MAX_TABLE_SIZE);
+			EXPECT(true, budget->getTotal() <= limit + EARLY_FLUSH_BYTES + 2048);
+			phase();
+
+			// Test reads through unpinned tables
+			for (i = 0; i < max; ++i)
+				EXPECT(std::string(1024, 'n'), bounded.get(i));
+			std::list<std::pair<uint64_t, std::string>> list;
+			bounded.scan(0, max - 1, list);
+			EXPECT(max, list.size());
+			phase();
+
+			// Test unpinned blocks stay in the block cache while the budget has room
+			budget->setLimit(budget->getTotal() + 4 * 1024 * 1024);
+			for (i = 0; i < max; ++i)
+				bounded.get(i);
+			EXPECT(true, budget->getUsage(MEM_CACHE) > 0);
+			uint64_t misses = stats->getTickerCount(BLOCK_CACHE_MISS);
+			uint64_t hits = stats->getTickerCount(BLOCK_CACHE_HIT);
+			for (i = 0; i < max; ++i)
+				EXPECT(std::string(1024, 'n'), bounded.get(i));
+			EXPECT(misses, stats->getTickerCount(BLOCK_CACHE_MISS));
+			EXPECT(true, stats->getTickerCount(BLOCK_CACHE_HIT) > hits);
+			phase();
+
+			// Test the cache gives its bytes back once the limit is tight again
+			budget->setLimit(limit);
+			for (i = 0; i < max; ++i)
+				bounded.put(i, std::string(1024, 'o'));
+			EXPECT(true, budget->getTotal() <= limit + EARLY_FLUSH_BYTES + 2048);
+			for (i = 0; i < max; ++i)
+				EXPECT(std::string(1024, 'o'), bounded.get(i));
+			phase();
+
+			bounded.reset();
+		}
+
+		// Test every byte is released with the store
+		EXPECT((uint64_t)0, budget->getTotal());
+
+		phase();
+
+		report();
+	}
+
+	void table_builder_test(uint64_t max)
+	{
+		uint64_t i;
+		CompactionOptions options;
+		options.directWrites = true;
+		options.bytesPerSync = 64 * 1024;
+		{
+			KVStore written("./data-direct", options);
+			written.reset();
+			for (i = 0; i < max; ++i)
+				written.put(i, std::string(i % 2048 + 1, 'd'));
+			written.deleteRange(max / 4, max / 2);
+		}
+
+		// Test tables written directly read back after reopening
+		{
+			KVStore reopened("./data-direct");
+			for (i = 0; i < max; ++i)
+				EXPECT(i >= max / 4 && i <= max / 2 ? not_found : std::string(i % 2048 + 1, 'd'), reopened.get(i));
+			std::list<std::pair<uint64_t, std::string>> list;
+			reopened.scan(0, max - 1, list);
+			EXPECT(max - (max / 2 - max / 4 + 1), list.size());
+			phase();
+
+			reopened.reset();
+		}
+
+		report();
+	}
+
+	void pinned_get_test(uint64_t max)
+	{
+		uint64_t i;
+		KVStore pinning("./data-pinned");
+		pinning.reset();
+		for (i = 0; i < max; ++i)
+			pinning.put(i, std::string(4096, 'a' + i % 26));
+		pinning.del(0);
+
+		// Test values from tables and from the memtable, and misses
+		PinnableSlice fromTable, fromMemtable, missing;
+		EXPECT(true, pinning.getPinned(1, &fromTable));
+		EXPECT(std::string(4096, 'b'), fromTable.toString());
+		EXPECT(true, pinning.getPinned(max - 1, &fromMemtable));
+		EXPECT(true, fromMemtable.pinned());
+		EXPECT(std::string(4096, 'a' + (max - 1) % 26), fromMemtable.toString());
+		EXPECT(false, pinning.getPinned(0, &missing));
+		EXPECT(false, pinning.getPinned(max, &missing));
+		EXPECT(true, missing.empty());
+		phase();
+
+		// Test pinned values outlive overwrites, compaction and the tables
+		for (i = 0; i < max; ++i)
+			pinning.put(i, std::string(4096, 'z'));
+		pinning.reset();
+		EXPECT(std::string(4096, 'b'), fromTable.toString());
+		EXPECT(std::string(4096, 'a' + (max - 1) % 26), fromMemtable.toString());
+		EXPECT(not_found, pinning.get(1));
+
+		phase();
+
+		report();
+	}
+
+	void memtable_hash_test(uint64_t max)
+	{
+		uint64_t i;
+		CompactionOptions options;
+		// few buckets, so keys share chains
+		options.memtableHashBuckets = 61;
+		KVStore hashed("./data-hashed", options);
+		hashed.reset();
+
+		// Test versions of a key found through the index, and misses
+		for (i = 0; i < max; ++i)
+			hashed.put(i, std::to_string(i));
+		const Snapshot *before = hashed.getSnapshot();
+		for (i = 0; i < max; i += 2)
+			hashed.put(i, "new" + std::to_string(i));
+		for (i = 0; i < max; i += 3)
+			hashed.del(i);
+		hashed.deleteRange(max / 2, max / 2 + 9);
+		for (i = 0; i < max; ++i)
+		{
+			std::string expected = i % 2 == 0 ? "new" + std::to_string(i) : std::to_string(i);
+			if (i % 3 == 0 || (i >= max / 2 && i <= max / 2 + 9))
+				expected = not_found;
+			EXPECT(expected, hashed.get(i));
+			EXPECT(std::to_string(i), hashed.get(i, before));
+		}
+		EXPECT(not_found, hashed.get(max));
+		hashed.releaseSnapshot(before);
+		phase();
+
+		// Test the index is rebuilt with every memtable
+		for (i = 0; i < 4 * max; ++i)
+			hashed.put(i, std::string(1024, 'h' + i % 8));
+		for (i = 0; i < 4 * max; ++i)
+			EXPECT(std::string(1024, 'h' + i % 8), hashed.get(i));
+		std::list<std::pair<uint64_t, std::string>> list;
+		hashed.scan(0, 4 * max - 1, list);
+		EXPECT(4 * max, list.size());
+
+		phase();
+
+		hashed.reset();
+
+		report();
+	}
+
+	void row_cache_test(uint64_t max)
+	{
+		uint64_t i;
+		CompactionOptions options;
+		options.rowCacheBytes = 256 * 1024;
+		KVStore cached("./data-rowcache", options);
+		cached.reset();
+		Statistics *stats = cached.getStatistics();
+		for (i = 0; i < max; ++i)
+			cached.put(i, std::string(512, 'r'));
+		for (i = 0; i < max; i += 4)
+			cached.del(i);
+		// push the tombstones out of the memtable, it answers before the cache
+		for (i = max + 1; i <= 2 * max; ++i)
+			cached.put(i, std::string(512, 'f'));
+
+		// Test rows and misses served again from the cache
+		for (i = 0; i < 64; ++i)
+			EXPECT(i % 4 == 0 ? not_found : std::string(512, 'r'), cached.get(i));
+		EXPECT(not_found, cached.get(max));
+		uint64_t hits = stats->getTickerCount(ROW_CACHE_HIT);
+		for (i = 0; i < 64; ++i)
+			EXPECT(i % 4 == 0 ? not_found : std::string(512, 'r'), cached.get(i));
+		EXPECT(not_found, cached.get(max));
+		EXPECT(hits + 65, stats->getTickerCount(ROW_CACHE_HIT));
+		EXPECT(true, cached.getProperty("stats").find("row cache") != std::string::npos);
+		phase();
+
+		// Test writes, deletes and range deletes drop cached rows
+		for (i = 0; i < 64; i += 2)
+			cached.put(i, "fresh");
+		cached.del(1);
+		cached.deleteRange(32, 47);
+		cached.put(max, "born");
+		for (i = 0; i < 64; ++i)
+		{
+			std::string expected = i % 2 == 0 ? "fresh" : i % 4 == 0 ? not_found : std::string(512, 'r');
+			if (i == 1 || (i >= 32 && i <= 47))
+				expected = not_found;
+			EXPECT(expected, cached.get(i));
+			EXPECT(expected, cached.get(i));
+		}
+		EXPECT("born", cached.get(max));
+		phase();
+
+		// Test the capacity holds while everything is read
+		for (i = 0; i < max; ++i)
+			cached.get(i);
+		EXPECT(true, cached.getMemoryBudget()->getUsage(MEM_CACHE) <= options.rowCacheBytes);
+		EXPECT(true, cached.getMemoryBudget()->getUsage(MEM_CACHE) > options.rowCacheBytes / 2);
+		cached.reset();
+		EXPECT(not_found, cached.get(2));
+
+		phase();
+
+		report();
+	}
+
+	void range_filter_test(uint64_t max)
+	{
+		uint64_t i;
+		// keys far apart, short scans mostly fall between them
+		const uint64_t gap = 1000;
+		CompactionOptions options;
+		options.rangeFilterBitsPerKey = 16;
+		{
+			KVStore filtered("./data-rangefilter", options);
+			filtered.reset();
+			for (i = 0; i < max; ++i)
+				filtered.put(i * gap, std::string(512, 'f'));
+		}
+		{
+			KVStore filtered("./data-rangefilter", options);
+			Statistics *stats = filtered.getStatistics();
+			std::list<std::pair<uint64_t, std::string>> list;
+
+			// Test scans between keys skip tables, scans over keys find them
+			for (i = 0; i < max; ++i)
+			{
+				list.clear();
+				filtered.scan(i * gap + 1, i * gap + 100, list);
+				EXPECT((size_t)0, list.size());
+			}
+			EXPECT(true, stats->getTickerCount(RANGE_FILTER_USEFUL) > max / 2);
+			for (i = 0; i + 1 < max; ++i)
+			{
+				list.clear();
+				filtered.scan(i * gap + gap / 2, i * gap + gap + gap / 2, list);
+				EXPECT((size_t)1, list.size());
+				EXPECT((i + 1) * gap, list.empty() ? 0 : list.front().first);
+			}
+			list.clear();
+			filtered.scan(0, max * gap, list);
+			EXPECT(max, list.size());
+			phase();
+
+			// Test tables written by compaction carry the filter
+			for (i = 0; i < max; i += 2)
+				filtered.put(i * gap, std::string(512, 'g'));
+			for (i = 0; i < max; ++i)
+			{
+				list.clear();
+				filtered.scan(i * gap, i * gap + gap - 1, list);
+				EXPECT((size_t)1, list.size());
+				EXPECT(std::string(512, i % 2 == 0 ? 'g' : 'f'), list.empty() ? not_found : list.front().second);
+			}
+
+			phase();
+
+			filtered.reset();
+		}
+
+		report();
+	}
+
+	void partitioned_index_test(uint64_t max)
+	{
+		uint64_t i;
+		CompactionOptions options;
+		// small partitions, so every table has many and a get loads one
+		options.indexPartitionEntries = 16;
+		options.blockCacheBytes = 256 * 1024;
+		{
+			KVStore partitioned("./data-partitioned", options);
+			partitioned.reset();
+			for (i = 0; i < max; ++i)
+				partitioned.put(i, std::string(512, 'p'));
+			const Snapshot *before = partitioned.getSnapshot();
+			for (i = 0; i < max; i += 3)
+				partitioned.put(i, "new" + std::to_string(i));
+			for (i = 0; i < max; i += 7)
+				partitioned.del(i);
+
+			// Test versions kept for a snapshot are found on either side of a partition
+			for (i = 0; i < max; ++i)
+			{
+				std::string expected = i % 3 == 0 ? "new" + std::to_string(i) : std::string(512, 'p');
+				EXPECT(i % 7 == 0 ? not_found : expected, partitioned.get(i));
+				EXPECT(std::string(512, 'p'), partitioned.get(i, before));
+			}
+			partitioned.releaseSnapshot(before);
+			phase();
+		}
+		{
+			KVStore partitioned("./data-partitioned", options);
+			Statistics *stats = partitioned.getStatistics();
+			MemoryBudget *budget = partitioned.getMemoryBudget();
+			std::list<std::pair<uint64_t, std::string>> list;
+
+			// Test reopened tables keep only the top level and read partitions on demand
+			EXPECT(true, budget->getUsage(MEM_FILTER) == 0);
+			for (i = 0; i < max; ++i)
+			{
+				std::string expected = i % 3 == 0 ? "new" + std::to_string(i) : std::string(512, 'p');
+				EXPECT(i % 7 == 0 ? not_found : expected, partitioned.get(i));
+			}
+			EXPECT(not_found, partitioned.get(max));
+			uint64_t hits = stats->getTickerCount(BLOCK_CACHE_HIT);
+			for (i = 0; i < 64; ++i)
+				partitioned.get(i);
+			EXPECT(true, stats->getTickerCount(BLOCK_CACHE_HIT) > hits);
+			EXPECT(true, budget->getUsage(MEM_CACHE) <= options.blockCacheBytes);
+			EXPECT(true, partitioned.getProperty("stats").find("block cache") != std::string::npos);
+			phase();
+
+			// Test scans go on from one partition into the next
+			partitioned.scan(0, max - 1, list);
+			EXPECT(max - (max + 6) / 7, list.size());
+			for (i = 0; i + 100 < max; i += 97)
+			{
+				list.clear();
+				partitioned.scan(i, i + 99, list);
+				uint64_t deleted = (i + 99) / 7 + 1 - (i + 6) / 7;
+				EXPECT(100 - deleted, list.size());
+			}
+			phase();
+		}
+		{
+			// Test a store reading tables whole opens partitioned tables
+			KVStore whole("./data-partitioned");
+			for (i = 0; i < max; ++i)
+			{
+				std::string expected = i % 3 == 0 ? "new" + std::to_string(i) : std::string(512, 'p');
+				EXPECT(i % 7 == 0 ? not_found : expected, whole.get(i));
+			}
+			phase();
+
+			whole.reset();
+		}
+
+		report();
+	}
+
+	void filter_type_test(uint64_t max)
+	{
+		uint64_t i;
+		std::vector<uint64_t> keys, versions;
+		for (i = 0; i < max; ++i)
+		{
+			keys.push_back(i * 7919);
+			// two versions of every key
+			versions.push_back(i * 7919);
+			versions.push_back(i * 7919);
+		}
+
+		// Test an XOR filter misses no key and beats a Bloom filter of the same size
+		FilterBlock bloom(keys, 10, BLOOM_FILTER);
+		FilterBlock built(versions, 10, XOR_FILTER);
+		std::vector<char> buf(built.byteSize());
+		built.saveBuffer(buf.data());
+		FilterBlock xorFilter(buf.data(), buf.size());
+		EXPECT(XOR_FILTER, xorFilter.getType());
+		EXPECT(true, xorFilter.byteSize() <= bloom.byteSize());
+		uint64_t missed = 0, bloomPositives = 0, xorPositives = 0;
+		for (i = 0; i < max; ++i)
+		{
+			missed += !xorFilter.mayContain(i * 7919);
+			bloomPositives += bloom.mayContain(i * 7919 + 1);
+			xorPositives += xorFilter.mayContain(i * 7919 + 1);
+		}
+		EXPECT((uint64_t)0, missed);
+		EXPECT(true, xorPositives < bloomPositives);
+		phase();
+
+		CompactionOptions options;
+		options.filterBitsPerKey = 10;
+		options.filterType = XOR_FILTER;
+		options.filterTypeLevel = 1;
+		{
+			KVStore filtered("./data-filtertype", options);
+			filtered.reset();
+			for (i = 0; i < max; ++i)
+				filtered.put(i * 2, std::string(512, 'x'));
+		}
+		{
+			KVStore filtered("./data-filtertype", options);
+			Statistics *stats = filtered.getStatistics();
+
+			// Test reopened tables keep sized filters in place of the fixed ones
+			EXPECT(true, filtered.getMemoryBudget()->getUsage(MEM_FILTER) < 2 * max);
+			for (i = 0; i < 2 * max; ++i)
+				EXPECT(i % 2 == 0 ? std::string(512, 'x') : not_found, filtered.get(i));
+			EXPECT(true, stats->getTickerCount(BLOOM_USEFUL) > max / 2);
+			phase();
+		}
+		{
+			// Test a store with no filter options reads the tables
+			KVStore plain("./data-filtertype");
+			for (i = 0; i < 2 * max; ++i)
+				EXPECT(i % 2 == 0 ? std::string(512, 'x') : not_found, plain.get(i));
+			phase();
+
+			plain.reset();
+		}
+
+		report();
+	}
+
+	void filter_allocation_test(uint64_t max)
+	{
+		uint64_t i;
+		// one run of 1k keys over one of 10k over one of 100k, then an empty level
+		std::vector<std::vector<std::shared_ptr<SSTableCache>>> cache(4);
+		uint64_t sizes[3] = {1000, 10000, 100000};
+		for (i = 0; i < 3; ++i)
+		{
+			std::shared_ptr<SSTableCache> table = std::make_shared<SSTableCache>();
+			table->Header.timestamp = 3 - i;
+			table->Header.num = sizes[i];
+			cache[i].push_back(table);
+		}
+
+		// Test upper levels get more bits per key and the budget is kept
+		uint64_t budgetBits = 10 * (sizes[0] + sizes[1] + sizes[2]);
+		std::vector<uint32_t> bits = allocateFilterBits(cache, budgetBits);
+		EXPECT((size_t)4, bits.size());
+		EXPECT(true, bits[0] > bits[1] && bits[1] > bits[2] && bits[2] > 0);
+		EXPECT(bits[2], bits[3]);
+		uint64_t used = 0;
+		for (i = 0; i < 3; ++i)
+			used += sizes[i] * bits[i];
+		EXPECT(true, used <= budgetBits + budgetBits / 20 && used >= budgetBits - budgetBits / 10);
+		phase();
+
+		// Test a larger budget gives every level at least as many bits
+		std::vector<uint32_t> more = allocateFilterBits(cache, 2 * budgetBits);
+		EXPECT(true, more[0] >= bits[0] && more[1] >= bits[1] && more[2] > bits[2]);
+		phase();
+
+		CompactionOptions options;
+		options.filterBudgetBytes = max * 2;
+		{
+			KVStore budgeted("./data-filteralloc", options);
+			budgeted.reset();
+			for (i = 0; i < max; ++i)
+				budgeted.put(i * 2, std::string(512, 'b'));
+			EXPECT(true, budgeted.getProperty("memory").find("filter bits per key") != std::string::npos);
+		}
+		{
+			KVStore budgeted("./data-filteralloc", options);
+			Statistics *stats = budgeted.getStatistics();
+
+			// Test tables written under the budget keep sized filters that reject missing keys
+			EXPECT(true, budgeted.getMemoryBudget()->getUsage(MEM_FILTER) < 4 * max);
+			for (i = 0; i < 2 * max; ++i)
+				EXPECT(i % 2 == 0 ? std::string(512, 'b') : not_found, budgeted.get(i));
+			EXPECT(true, stats->getTickerCount(BLOOM_USEFUL) > max / 2);
+			phase();
+
+			budgeted.reset();
+		}
+
+		report();
+	}
+
+	void checksum_test(uint64_t max)
+	{
+		uint64_t i;
+
+		// Test CRC32C gives the standard check value however the bytes are split
+		EXPECT((uint32_t)0xe3069283, crc32c::value("123456789", 9));
+		EXPECT(crc32c::value("123456789", 9), crc32c::extend(crc32c::value("1234", 4), "56789", 5));
+		phase();
+
+		CompactionOptions options;
+		options.indexPartitionEntries = 64;
+		std::shared_ptr<RecordingListener> listener = std::make_shared<RecordingListener>();
+		std::vector<std::string> tables;
+		{
+			KVStore checked("./data-checksum", options);
+			checked.reset();
+			for (i = 0; i < max; ++i)
+				checked.put(i, std::string(512, 'c'));
+		}
+		{
+			KVStore checked("./data-checksum", options);
+			Statistics *stats = checked.getStatistics();
+
+			// Test reopened tables, partitions and values pass their checksums
+			for (i = 0; i < max; ++i)
+				EXPECT(std::string(512, 'c'), checked.get(i));
+			std::list<std::pair<uint64_t, std::string>> list;
+			checked.scan(0, max - 1, list);
+			EXPECT(max, list.size());
+			EXPECT((uint32_t)0, checked.scrub(UINT32_MAX));
+			EXPECT(true, stats->getTickerCount(TABLES_SCRUBBED) > 0);
+			phase();
+
+			// Test a round reads back only as many tables as asked for
+			uint64_t scrubbed = stats->getTickerCount(TABLES_SCRUBBED);
+			checked.scrub(1);
+			EXPECT(scrubbed + 1, stats->getTickerCount(TABLES_SCRUBBED));
+			for (uint32_t level = 0; utils::dirExists("./data-checksum/level-" + std::to_string(level)); ++level)
+			{
+				std::string dir = "./data-checksum/level-" + std::to_string(level);
+				std::vector<std::string> names;
+				utils::scanDir(dir, names);
+				for (auto it = names.begin(); it != names.end(); ++it)
+					tables.push_back(dir + "/" + *it);
+			}
+			EXPECT(true, !tables.empty());
+			phase();
+		}
+		{
+			// a bit flipped in the first value of a table, as a torn write would leave it
+			std::fstream file(tables.front(), std::ios::in | std::ios::out | std::ios::binary);
+			uint64_t num;
+			file.seekg(8);
+			file.read((char *)&num, 8);
+			char byte;
+			file.seekg(10272 + 12 * num);
+			file.read(&byte, 1);
+			byte ^= 1;
+			file.seekp(10272 + 12 * num);
+			file.write(&byte, 1);
+		}
+		{
+			KVStore checked("./data-checksum", options);
+			checked.addListener(listener);
+
+			// Test the scrubber finds the table and reports it
+			EXPECT((uint32_t)1, checked.scrub(UINT32_MAX));
+			EXPECT(true, SSTableCache(tables.front()).verify() == false);
+			EXPECT(true, SSTableCache(tables.back()).verify() || tables.size() == 1);
+			EXPECT(true, checked.getProperty("stats").find("scrub.corrupt.tables") != std::string::npos);
+		}
+		EXPECT((size_t)1, listener->corrupted.size());
+		EXPECT((size_t)1, listener->corrupted.count(tables.front()));
+		phase();
+
+		KVStore("./data-checksum").reset();
+
+		report();
+	}
 
 public:
 	CorrectnessTest(const std::string &dir, bool v = true) : Test(dir, v)
@@ -105,6 +1218,80 @@ public:
 
 		std::cout << "[Large Test]" << std::endl;
 		regular_test(LARGE_TEST_MAX);
+
+		store.reset();
+
+		std::cout << "[Range Delete Test]" << std::endl;
+		range_delete_test(RANGE_TEST_MAX);
+
+		store.reset();
+
+		std::cout << "[Snapshot Test]" << std::endl;
+		snapshot_test(RANGE_TEST_MAX);
+
+		store.reset();
+
+		std::cout << "[Tombstone Test]" << std::endl;
+		tombstone_test(RANGE_TEST_MAX);
+
+		store.reset();
+
+		std::cout << "[Concurrent Test]" << std::endl;
+		concurrent_test(RANGE_TEST_MAX);
+
+		std::cout << "[Compaction Test]" << std::endl;
+		compaction_test(RANGE_TEST_MAX * 2, LEVELED_COMPACTION);
+		compaction_test(RANGE_TEST_MAX * 2, TIERED_COMPACTION);
+		compaction_test(RANGE_TEST_MAX * 2, LAZY_LEVELED_COMPACTION);
+
+		std::cout << "[Subcompaction Test]" << std::endl;
+		subcompaction_test(RANGE_TEST_MAX * 2, 8);
+
+		std::cout << "[Rate Limit Test]" << std::endl;
+		rate_limit_test(RANGE_TEST_MAX * 2);
+
+		std::cout << "[Sharded Test]" << std::endl;
+		sharded_test(RANGE_TEST_MAX, HASH_PARTITION);
+		sharded_test(RANGE_TEST_MAX, RANGE_PARTITION);
+
+		std::cout << "[Statistics Test]" << std::endl;
+		statistics_test(RANGE_TEST_MAX);
+
+		std::cout << "[Perf Context Test]" << std::endl;
+		perf_context_test(RANGE_TEST_MAX);
+
+		std::cout << "[Event Listener Test]" << std::endl;
+		event_listener_test(RANGE_TEST_MAX);
+
+		std::cout << "[Memory Budget Test]" << std::endl;
+		memory_budget_test(RANGE_TEST_MAX);
+
+		std::cout << "[Table Builder Test]" << std::endl;
+		table_builder_test(RANGE_TEST_MAX);
+
+		std::cout << "[Pinned Get Test]" << std::endl;
+		pinned_get_test(RANGE_TEST_MAX);
+
+		std::cout << "[Memtable Hash Test]" << std::endl;
+		memtable_hash_test(RANGE_TEST_MAX);
+
+		std::cout << "[Row Cache Test]" << std::endl;
+		row_cache_test(RANGE_TEST_MAX);
+
+		std::cout << "[Range Filter Test]" << std::endl;
+		range_filter_test(RANGE_TEST_MAX);
+
+		std::cout << "[Partitioned Index Test]" << std::endl;
+		partitioned_index_test(RANGE_TEST_MAX);
+
+		std::cout << "[Filter Type Test]" << std::endl;
+		filter_type_test(RANGE_TEST_MAX);
+
+		std::cout << "[Filter Allocation Test]" << std::endl;
+		filter_allocation_test(RANGE_TEST_MAX);
+
+		std::cout << "[Checksum Test]" << std::endl;
+		checksum_test(RANGE_TEST_MAX);
 	}
 };
 
@@ -0,0 +1,115 @@
+#include "crc32c.h"
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CRC32C_SSE42 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM 1
+#endif
+
+namespace crc32c
+{
+    // reflected Castagnoli polynomial
+    static const uint32_t POLY = 0x82f63b78;
+
+    struct Table
+    {
+        uint32_t entries[256];
+        Table()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t crc = i;
+                for (uint32_t bit = 0; bit < 8; ++bit)
+                    crc = (crc >> 1) ^ (crc & 1 ? POLY : 0);
+                entries[i] = crc;
+            }
+        }
+    };
+
+    static uint32_t extendSoftware(uint32_t crc, const char *data, size_t size)
+    {
+        static const Table table;
+        const uint8_t *pos = (const uint8_t *)data;
+        for (size_t i = 0; i < size; ++i)
+            crc = table.entries[(crc ^ pos[i]) & 0xff] ^ (crc >> 8);
+        return crc;
+    }
+
+#if defined(CRC32C_SSE42)
+    __attribute__((target("sse4.2"))) static uint32_t extendHardware(uint32_t crc, const char *data, size_t size)
+    {
+        const uint8_t *pos = (const uint8_t *)data;
+#if defined(__x86_64__)
+        uint64_t crc64 = crc;
+        for (; size >= 8; size -= 8, pos += 8)
+        {
+            uint64_t word;
+            memcpy(&word, pos, 8);
+            crc64 = _mm_crc32_u64(crc64, word);
+        }
+        crc = (uint32_t)crc64;
+#endif
+        for (; size >= 4; size -= 4, pos += 4)
+        {
+            uint32_t word;
+            memcpy(&word, pos, 4);
+            crc = _mm_crc32_u32(crc, word);
+        }
+        for (; size > 0; --size, ++pos)
+            crc = _mm_crc32_u8(crc, *pos);
+        return crc;
+    }
+
+    static bool detect()
+    {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2");
+    }
+#elif defined(CRC32C_ARM)
+    static uint32_t extendHardware(uint32_t crc, const char *data, size_t size)
+    {
+        const uint8_t *pos = (const uint8_t *)data;
+        for (; size >= 8; size -= 8, pos += 8)
+        {
+            uint64_t word;
+            memcpy(&word, pos, 8);
+            crc = __crc32cd(crc, word);
+        }
+        for (; size > 0; --size, ++pos)
+            crc = __crc32cb(crc, *pos);
+        return crc;
+    }
+
+    // built for a CPU that has the extension
+    static bool detect()
+    {
+        return true;
+    }
+#else
+    static uint32_t extendHardware(uint32_t crc, const char *data, size_t size)
+    {
+        return extendSoftware(crc, data, size);
+    }
+
+    static bool detect()
+    {
+        return false;
+    }
+#endif
+
+    bool hardware()
+    {
+        static const bool supported = detect();
+        return supported;
+    }
+
+    uint32_t extend(uint32_t crc, const char *data, size_t size)
+    {
+        crc = ~crc;
+        crc = hardware() ? extendHardware(crc, data, size) : extendSoftware(crc, data, size);
+        return ~crc;
+    }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * CRC32C (Castagnoli), the checksum of table heads, meta blocks, index
+ * partitions and values. Computed with the SSE4.2 crc32 instruction or
+ * the ARMv8 CRC extension where the CPU has it, eight bytes a step, and
+ * with a table a byte at a time otherwise.
+ */
+namespace crc32c
+{
+	// the checksum of data appended to bytes whose checksum was crc
+	uint32_t extend(uint32_t crc, const char *data, size_t size);
+
+	inline uint32_t value(const char *data, size_t size) { return extend(0, data, size); }
+
+	// whether extend() runs on the CPU's CRC instructions
+	bool hardware();
+}
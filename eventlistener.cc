@@ -0,0 +1,51 @@
+#include "eventlistener.h"
+
+void EventDispatcher::addListener(const std::shared_ptr<EventListener> &listener)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    listeners.push_back(listener);
+    hasListeners = true;
+    if (!worker.joinable() && !stopping)
+        worker = std::thread(&EventDispatcher::run, this);
+}
+
+void EventDispatcher::post(const std::function<void(EventListener &)> &event)
+{
+    if (!active())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(event);
+    }
+    cond.notify_one();
+}
+
+void EventDispatcher::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        cond.wait(lock, [this]() { return stopping || !queue.empty(); });
+        if (queue.empty())
+            return;
+        std::function<void(EventListener &)> event = queue.front();
+        queue.pop_front();
+        std::vector<std::shared_ptr<EventListener>> targets = listeners;
+        // listeners run unlocked so posting never waits on them
+        lock.unlock();
+        for (auto it = targets.begin(); it != targets.end(); ++it)
+            event(**it);
+        lock.lock();
+    }
+}
+
+void EventDispatcher::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cond.notify_all();
+    if (worker.joinable())
+        worker.join();
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+struct FlushJobInfo
+{
+	// known once the flush completed
+	std::string path;
+	uint64_t fileSize;
+	uint64_t micros;
+	uint64_t entries;
+	uint64_t rangeTombstones;
+	FlushJobInfo() : fileSize(0), micros(0), entries(0), rangeTombstones(0) {}
+};
+
+struct CompactionJobInfo
+{
+	uint32_t inputLevel;
+	uint32_t outputLevel;
+	std::vector<std::string> inputFiles;
+	// known once the compaction completed
+	std::vector<std::string> outputFiles;
+	uint64_t bytesRead;
+	uint64_t bytesWritten;
+	uint64_t micros;
+	bool trivialMove;
+	CompactionJobInfo() : inputLevel(0), outputLevel(0), bytesRead(0), bytesWritten(0), micros(0), trivialMove(false) {}
+};
+
+struct TableFileInfo
+{
+	std::string path;
+	uint32_t level;
+	uint64_t fileSize;
+	TableFileInfo(const std::string &path, uint32_t level, uint64_t fileSize) : path(path), level(level), fileSize(fileSize) {}
+};
+
+enum WriteStallCondition
+{
+	STALL_NORMAL = 0,
+	// the writer holds the write lock while the memtable is flushed and
+	// the compactions it triggers run
+	STALL_STOPPED
+};
+
+struct WriteStallInfo
+{
+	WriteStallCondition condition;
+	WriteStallCondition previous;
+};
+
+/**
+ * Receives the lifecycle events of a store. All callbacks run on one
+ * background thread in the order the events happened, never on the
+ * thread doing the work, so a slow listener only delays other listeners.
+ * A deleted table file is unlinked once no reader holds it any more.
+ */
+class EventListener
+{
+public:
+	virtual ~EventListener() {}
+	virtual void onFlushBegin(const FlushJobInfo &) {}
+	virtual void onFlushCompleted(const FlushJobInfo &) {}
+	virtual void onCompactionBegin(const CompactionJobInfo &) {}
+	virtual void onCompactionCompleted(const CompactionJobInfo &) {}
+	virtual void onTableFileCreated(const TableFileInfo &) {}
+	virtual void onTableFileDeleted(const TableFileInfo &) {}
+	// the scrubber found a table whose bytes do not match their checksums
+	virtual void onTableFileCorrupted(const TableFileInfo &) {}
+	virtual void onStallConditionsChanged(const WriteStallInfo &) {}
+};
+
+/**
+ * Queues events and delivers them to the listeners from its own thread,
+ * started with the first listener. Posting without listeners is a no-op,
+ * callers check active() before building an event at all.
+ */
+class EventDispatcher
+{
+private:
+	std::vector<std::shared_ptr<EventListener>> listeners;
+	std::deque<std::function<void(EventListener &)>> queue;
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::atomic<bool> hasListeners;
+	bool stopping;
+	std::thread worker;
+
+	void run();
+
+public:
+	EventDispatcher() : hasListeners(false), stopping(false) {}
+	~EventDispatcher() { stop(); }
+
+	void addListener(const std::shared_ptr<EventListener> &listener);
+
+	bool active() const { return hasListeners.load(std::memory_order_relaxed); }
+
+	void post(const std::function<void(EventListener &)> &event);
+
+	// delivers what is queued and stops the thread
+	void stop();
+};
@@ -0,0 +1,213 @@
+#include "filterblock.h"
+#include "MurmurHash3.h"
+#include <algorithm>
+#include <cstring>
+
+// an XOR filter needs 1.23 slots per key to be built, and a few more
+static uint64_t xorSegment(uint64_t num)
+{
+    return (num * 123 / 100 + 32 + 2) / 3;
+}
+
+static uint32_t fingerprintBits(uint32_t bitsPerKey)
+{
+    return std::min(std::max(bitsPerKey * 100 / 123, (uint32_t)1), (uint32_t)32);
+}
+
+static uint64_t rotl(uint64_t value, uint32_t shift)
+{
+    return (value << shift) | (value >> (64 - shift));
+}
+
+uint64_t FilterBlock::byteSize(uint64_t num, uint32_t bitsPerKey, FilterType type)
+{
+    uint64_t words = (num * bitsPerKey + 63) / 64;
+    uint64_t bloom = 8 + std::max(words, (uint64_t)1) * 8;
+    if (type != XOR_FILTER)
+        return bloom;
+    // keys that cannot be placed fall back to a Bloom filter
+    uint64_t slots = 3 * xorSegment(num);
+    return std::max(bloom, 24 + (slots * fingerprintBits(bitsPerKey) + 63) / 64 * 8);
+}
+
+FilterBlock::FilterBlock(const std::vector<uint64_t> &keys, uint32_t bitsPerKey, FilterType type)
+    : type(type), param(0), seed(0), segment(0)
+{
+    if (type == XOR_FILTER)
+    {
+        // versions of a key share its slots
+        std::vector<uint64_t> distinct(keys);
+        std::sort(distinct.begin(), distinct.end());
+        distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+        param = fingerprintBits(bitsPerKey);
+        segment = xorSegment(distinct.size());
+        for (seed = 1; seed <= 32; ++seed)
+        {
+            if (buildXor(distinct))
+                return;
+        }
+        this->type = BLOOM_FILTER;
+        seed = segment = 0;
+    }
+    buildBloom(keys, bitsPerKey);
+}
+
+void FilterBlock::buildBloom(const std::vector<uint64_t> &keys, uint32_t bitsPerKey)
+{
+    bits.assign((byteSize(keys.size(), bitsPerKey) - 8) / 8, 0);
+    // ln 2 hashes per bit of a key minimise the false positive rate
+    param = std::min(std::max((uint32_t)(bitsPerKey * 0.69 + 0.5), (uint32_t)1), (uint32_t)30);
+    uint64_t bitCount = bits.size() * 64;
+    for (auto it = keys.begin(); it != keys.end(); ++it)
+    {
+        uint64_t digest[2];
+        MurmurHash3_x64_128(&*it, sizeof(uint64_t), 1, digest);
+        uint64_t h = digest[0], delta = digest[1] | 1;
+        for (uint32_t i = 0; i < param; ++i, h += delta)
+            bits[(h % bitCount) / 64] |= 1ULL << (h % bitCount % 64);
+    }
+}
+
+void FilterBlock::slots(uint64_t hash, uint64_t slot[3]) const
+{
+    slot[0] = (hash & 0xffffffffULL) * segment >> 32;
+    slot[1] = (rotl(hash, 21) & 0xffffffffULL) * segment >> 32;
+    slot[2] = (rotl(hash, 42) & 0xffffffffULL) * segment >> 32;
+    slot[1] += segment;
+    slot[2] += 2 * segment;
+}
+
+/**
+ * Peel keys off slots only they map to until none are left, then fill
+ * the slots in the reverse order, each last one a key still needs set
+ * so its three slots xor to its fingerprint. False if this seed leaves
+ * keys that cannot be peeled.
+ */
+bool FilterBlock::buildXor(const std::vector<uint64_t> &keys)
+{
+    uint64_t capacity = 3 * segment;
+    std::vector<uint32_t> count(capacity, 0);
+    std::vector<uint64_t> hashes(capacity, 0);
+    uint64_t slot[3];
+    for (auto it = keys.begin(); it != keys.end(); ++it)
+    {
+        uint64_t hash = fmix64(*it + seed);
+        slots(hash, slot);
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+            ++count[slot[i]];
+            hashes[slot[i]] ^= hash;
+        }
+    }
+    std::vector<uint64_t> queue;
+    for (uint64_t i = 0; i < capacity; ++i)
+    {
+        if (count[i] == 1)
+            queue.push_back(i);
+    }
+    // the hash of each peeled key and the slot it was peeled from
+    std::vector<std::pair<uint64_t, uint64_t>> peeled;
+    peeled.reserve(keys.size());
+    while (!queue.empty())
+    {
+        uint64_t free = queue.back();
+        queue.pop_back();
+        if (count[free] != 1)
+            continue;
+        uint64_t hash = hashes[free];
+        peeled.push_back(std::make_pair(hash, free));
+        slots(hash, slot);
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+            hashes[slot[i]] ^= hash;
+            if (--count[slot[i]] == 1)
+                queue.push_back(slot[i]);
+        }
+    }
+    if (peeled.size() != keys.size())
+        return false;
+    bits.assign((capacity * param + 63) / 64, 0);
+    uint64_t mask = (1ULL << param) - 1;
+    for (auto it = peeled.rbegin(); it != peeled.rend(); ++it)
+    {
+        uint64_t hash = it->first;
+        slots(hash, slot);
+        uint64_t value = ((hash ^ (hash >> 32)) & mask) ^ readSlot(slot[0]) ^ readSlot(slot[1]) ^ readSlot(slot[2]);
+        writeSlot(it->second, value);
+    }
+    return true;
+}
+
+uint64_t FilterBlock::readSlot(uint64_t slot) const
+{
+    uint64_t pos = slot * param;
+    uint64_t value = bits[pos / 64] >> (pos % 64);
+    if (pos % 64 + param > 64)
+        value |= bits[pos / 64 + 1] << (64 - pos % 64);
+    return value & ((1ULL << param) - 1);
+}
+
+void FilterBlock::writeSlot(uint64_t slot, uint64_t value)
+{
+    // slots are written once, into zeroed bits
+    uint64_t pos = slot * param;
+    bits[pos / 64] |= value << (pos % 64);
+    if (pos % 64 + param > 64)
+        bits[pos / 64 + 1] |= value >> (64 - pos % 64);
+}
+
+FilterBlock::FilterBlock(const char *buf, uint64_t size) : param(0), seed(0), segment(0)
+{
+    uint8_t stored = size >= 8 ? (uint8_t)buf[4] : (uint8_t)BLOOM_FILTER;
+    type = stored == XOR_FILTER ? XOR_FILTER : BLOOM_FILTER;
+    if (size < headerBytes() + 8 || stored > XOR_FILTER)
+        return;
+    memcpy(&param, buf, 4);
+    if (type == XOR_FILTER)
+    {
+        memcpy(&seed, buf + 8, 8);
+        memcpy(&segment, buf + 16, 8);
+        // a filter this build cannot read is taken as none
+        if (param == 0 || param > 32 || (3 * segment * param + 63) / 64 * 8 != size - headerBytes())
+            return;
+    }
+    bits.resize((size - headerBytes()) / 8);
+    memcpy(&bits[0], buf + headerBytes(), bits.size() * 8);
+}
+
+bool FilterBlock::mayContain(uint64_t key) const
+{
+    if (bits.empty())
+        return true;
+    if (type == XOR_FILTER)
+    {
+        uint64_t hash = fmix64(key + seed), slot[3];
+        slots(hash, slot);
+        uint64_t mask = (1ULL << param) - 1;
+        return ((hash ^ (hash >> 32)) & mask) == (readSlot(slot[0]) ^ readSlot(slot[1]) ^ readSlot(slot[2]));
+    }
+    uint64_t bitCount = bits.size() * 64;
+    uint64_t digest[2];
+    MurmurHash3_x64_128(&key, sizeof(key), 1, digest);
+    uint64_t h = digest[0], delta = digest[1] | 1;
+    for (uint32_t i = 0; i < param; ++i, h += delta)
+    {
+        if (!(bits[(h % bitCount) / 64] & (1ULL << (h % bitCount % 64))))
+            return false;
+    }
+    return true;
+}
+
+void FilterBlock::saveBuffer(char *buf) const
+{
+    memset(buf, 0, headerBytes());
+    memcpy(buf, &param, 4);
+    buf[4] = (char)type;
+    if (type == XOR_FILTER)
+    {
+        memcpy(buf + 8, &seed, 8);
+        memcpy(buf + 16, &segment, 8);
+    }
+    if (!bits.empty())
+        memcpy(buf + headerBytes(), &bits[0], bits.size() * 8);
+}
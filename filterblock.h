@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// kept in the byte after the parameter, tables name the filter they carry
+enum FilterType
+{
+	BLOOM_FILTER = 0,
+	XOR_FILTER
+};
+
+/**
+ * A filter sized to the keys it is built from, for a table or the part of
+ * it one index partition covers. The whole-table BloomFilter has a fixed
+ * size; this one takes about bitsPerKey bits per key. A Bloom filter
+ * builds fastest; an XOR filter stores a fingerprint of bitsPerKey / 1.23
+ * bits for each key in one of three slots, so that the three slots of a
+ * key xor to its fingerprint, and reaches the false positive rate of a
+ * Bloom filter with about a third fewer bits.
+ */
+class FilterBlock
+{
+private:
+	FilterType type;
+	// probes per key of a Bloom filter, bits per fingerprint of an XOR filter
+	uint32_t param;
+	uint64_t seed;
+	// slots per each of the three positions of an XOR filter
+	uint64_t segment;
+	std::vector<uint64_t> bits;
+
+	void buildBloom(const std::vector<uint64_t> &keys, uint32_t bitsPerKey);
+	bool buildXor(const std::vector<uint64_t> &keys);
+	uint64_t readSlot(uint64_t slot) const;
+	void writeSlot(uint64_t slot, uint64_t value);
+	// the three slots of the key that hashed to hash, one per segment
+	void slots(uint64_t hash, uint64_t slot[3]) const;
+	uint64_t headerBytes() const { return type == XOR_FILTER ? 24 : 8; }
+
+public:
+	FilterBlock(const std::vector<uint64_t> &keys, uint32_t bitsPerKey, FilterType type = BLOOM_FILTER);
+	// what saveBuffer wrote, size bytes of it
+	FilterBlock(const char *buf, uint64_t size);
+
+	bool mayContain(uint64_t key) const;
+	FilterType getType() const { return type; }
+
+	uint64_t byteSize() const { return headerBytes() + bits.size() * 8; }
+	void saveBuffer(char *buf) const;
+
+	// at least byteSize() of the filter of num keys
+	static uint64_t byteSize(uint64_t num, uint32_t bitsPerKey, FilterType type = BLOOM_FILTER);
+};
@@ -2,11 +2,45 @@
 #include <string>
 #include "utils.h"
 #include <algorithm>
+#include <map>
+#include <thread>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
 
-KVStore::KVStore(const std::string &dir) : KVStoreAPI(dir)
+KVStore::KVStore(const std::string &dir, const CompactionOptions &options) : KVStoreAPI(dir)
 {
     dataDir = dir;
+    policy = CompactionPolicy::create(options);
+    rateLimiter = options.rateLimiter;
+    writeOptions.rateLimiter = rateLimiter.get();
+    writeOptions.directWrites = options.directWrites;
+    writeOptions.bytesPerSync = options.bytesPerSync;
+    writeOptions.rangeFilterBitsPerKey = options.rangeFilterBitsPerKey;
+    writeOptions.indexPartitionEntries = options.indexPartitionEntries;
+    writeOptions.partitionFilterBitsPerKey = options.partitionFilterBitsPerKey;
+    writeOptions.filterBitsPerKey = options.filterBitsPerKey;
+    filterType = options.filterType;
+    filterTypeLevel = options.filterTypeLevel;
+    filterBudgetBits = options.filterBudgetBytes * 8;
+    subcompactions = options.subcompactions;
+    hashBuckets = options.memtableHashBuckets;
+    verifyMappedReads = options.verifyMappedReads;
+    // without a budget of its own the store still accounts its memory
+    budget = options.memoryBudget ? options.memoryBudget : std::make_shared<MemoryBudget>();
+    if (options.rowCacheBytes > 0)
+        rowCache.reset(new RowCache(options.rowCacheBytes, budget.get()));
+    // any store may unpin blocks once its budget gets a limit
+    blockCache.reset(new BlockCache(options.blockCacheBytes, budget.get()));
+    // tables written with partitions are read whole unless this store partitions too
+    BlockCache *partitionCache = options.indexPartitionEntries > 0 ? blockCache.get() : nullptr;
+    stats.reset(new Statistics());
+    stopDump = false;
+    stopScrub = false;
     currentTime = 0;
+    uint64_t maxSeq = 0;
+    std::shared_ptr<Version> version = std::make_shared<Version>();
+    std::vector<std::vector<std::shared_ptr<SSTableCache>>> &cache = version->cache;
     if (utils::dirExists(dataDir))
     {
         std::vector<std::string> levelNames;
@@ -18,17 +52,20 @@ KVStore::KVStore(const std::string &dir) : KVStoreAPI(dir)
                 std::string levelName = "level-" + std::to_string(i);
                 if (std::count(levelNames.begin(), levelNames.end(), levelName) == 1)
                 {
-                    cache.push_back(std::vector<SSTableCache *>());
+                    cache.push_back(std::vector<std::shared_ptr<SSTableCache>>());
                     std::string levelDir = dataDir + "/" + levelName;
                     std::vector<std::string> tableNames;
                     int tableNum = utils::scanDir(levelDir, tableNames);
                     for (int j = 0; j < tableNum; ++j)
                     {
-                        SSTableCache *curCache = new SSTableCache(levelDir + "/" + tableNames[j]);
+                        std::shared_ptr<SSTableCache> curCache = std::make_shared<SSTableCache>(levelDir + "/" + tableNames[j], partitionCache);
+                        curCache->setBudget(budget.get());
                         uint64_t curTime = (curCache->Header).timestamp;
                         cache[i].push_back(curCache);
                         if (curTime > currentTime)
                             currentTime = curTime;
+                        if (curCache->maxSeq > maxSeq)
+                            maxSeq = curCache->maxSeq;
                     }
                     std::sort(cache[i].begin(), cache[i].end(), cacheTimeCompare);
                 }
@@ -39,30 +76,33 @@ KVStore::KVStore(const std::string &dir) : KVStoreAPI(dir)
         else
         {
             utils::mkdir((dataDir + "/level-0").c_str());
-            cache.push_back(std::vector<SSTableCache *>());
+            cache.push_back(std::vector<std::shared_ptr<SSTableCache>>());
         }
     }
     else
     {
         utils::mkdir(dataDir.c_str());
         utils::mkdir((dataDir + "/level-0").c_str());
-        cache.push_back(std::vector<SSTableCache *>());
+        cache.push_back(std::vector<std::shared_ptr<SSTableCache>>());
     }
     currentTime++;
-    memTable = new SkipList();
+    lastSequence = maxSeq;
+    version->memTable = std::make_shared<SkipList>(budget.get(), hashBuckets);
+    version->retired = std::make_shared<RetiredBlocks>();
+    current = version;
+    if (filterBudgetBits > 0)
+        levelFilterBits = allocateFilterBits(version->cache, filterBudgetBits, filterType, filterTypeLevel);
+    enforceBudget();
 }
 
 KVStore::~KVStore()
 {
-    if (memTable->length > 0)
-        memTable->transform(dataDir + "/level-0", currentTime++);
-    delete memTable;
-    compact();
-    for (auto it1 = cache.begin(); it1 != cache.end(); ++it1)
-    {
-        for (auto it2 = (*it1).begin(); it2 != (*it1).end(); ++it2)
-            delete (*it2);
-    }
+    stopStatsDump();
+    stopScrubber();
+    if (current->memTable->length > 0 || !current->memTable->RangeDel->empty())
+        flush();
+    events.stop();
+    current.reset();
 }
 
 /**
@@ -71,26 +111,17 @@ KVStore::~KVStore()
  */
 void KVStore::put(uint64_t key, const std::string &s)
 {
-    std::string tmp = s;
-    if (memTable->needTransform(key, tmp))
-    {
-        cache[0].push_back(memTable->transform(dataDir + "/level-0", currentTime++));
-        delete memTable;
-        memTable = new SkipList;
-        memTable->Insert(key, s);
-        std::sort(cache[0].begin(), cache[0].end(), cacheTimeCompare);
-        compact();
-        return;
-    }
-    if (memTable->Search(key) == "")
-        memTable->Insert(key, tmp);
-    else
-    {
-        memTable->cacheSize = memTable->cacheSize - memTable->hot->val.size() + tmp.size();
-        memTable->hot->val = tmp;
-
-    }
-
+    StopWatch watch(stats.get(), PUT_LATENCY);
+    stats->recordTick(KEYS_WRITTEN);
+    stats->recordTick(BYTES_WRITTEN, 8 + s.size());
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (current->memTable->needTransform(s, levelWriteOptions(0)) || overBudget())
+        flushStalled();
+    uint64_t seq = lastSequence + 1;
+    current->memTable->Insert(key, seq, s);
+    lastSequence = seq;
+    if (rowCache)
+        rowCache->erase(key, seq);
 }
 /**
  * Returns the (string) value of the given key.
@@ -98,52 +129,147 @@ void KVStore::put(uint64_t key, const std::string &s)
  */
 std::string KVStore::get(uint64_t key)
 {
+    return get(key, nullptr);
+}
 
-    std::string ret = memTable->Search(key);
-    if (ret != "")
+/**
+ * Returns the value of the given key as seen by the snapshot,
+ * or the latest value if snapshot is null.
+ */
+std::string KVStore::get(uint64_t key, const Snapshot *snapshot)
+{
+    PinnableSlice value;
+    if (!getPinned(key, &value, snapshot))
+        return "";
+    return value.toString();
+}
+
+/**
+ * Same as get, but the value is not copied: it points into the memtable
+ * or the mapped table file, which the slice keeps alive until it is
+ * reset. Returns false iff the key is not found.
+ */
+bool KVStore::getPinned(uint64_t key, PinnableSlice *value, const Snapshot *snapshot)
+{
+    StopWatch watch(stats.get(), GET_LATENCY);
+    stats->recordTick(KEYS_READ);
+    value->reset();
+    // writes up to fillSeq are in the version loaded after it, the row
+    // cache refuses the result if a later write got there first
+    bool cached = rowCache && !snapshot;
+    uint64_t fillSeq = cached ? lastSequence.load() : 0;
+    // the version is pinned first, so it holds everything up to seq
+    std::shared_ptr<Version> version = std::atomic_load(&current);
+    uint64_t seq = snapshot ? snapshot->sequence : lastSequence.load();
+    std::vector<std::vector<std::shared_ptr<SSTableCache>>> &cache = version->cache;
+    // a range tombstone hides every version older than itself
+    uint64_t delSeq = coveringSeq(*version->memTable->getRangeDel(), key, seq);
+    PERF_TIMER_START(memtableTimer, memtableNanos);
+    SKNode *node = version->memTable->Search(key, seq);
+    PERF_TIMER_STOP(memtableTimer);
+    if (node)
     {
-        if (ret == "~DELETED~")
-            return "";
-        else
-            return ret;
+        if (node->val == "~DELETED~" || node->seq < delSeq)
+        {
+            stats->recordTick(GET_MISS);
+            return false;
+        }
+        // nodes are never changed once linked, the memtable holds the value
+        value->pin(node->val.data(), node->val.size(), version->memTable);
+        stats->recordTick(GET_HIT_MEMTABLE);
+        stats->recordTick(BYTES_READ, 8 + value->size());
+        return true;
+    }
+    if (delSeq > 0)
+    {
+        stats->recordTick(GET_MISS);
+        return false;
+    }
+    if (cached)
+    {
+        std::shared_ptr<const std::string> row;
+        if (rowCache->lookup(key, row))
+        {
+            stats->recordTick(ROW_CACHE_HIT);
+            if (!row)
+            {
+                stats->recordTick(GET_MISS);
+                return false;
+            }
+            value->pin(row->data(), row->size(), row);
+            stats->recordTick(BYTES_READ, 8 + value->size());
+            return true;
+        }
+        stats->recordTick(ROW_CACHE_MISS);
     }
     int levelNum = cache.size();
     for (int i = 0; i < levelNum; ++i)
     {
+        // the tombstone may sit in another table of the level than the key
+        for (auto it = cache[i].begin(); it != cache[i].end(); ++it)
+            delSeq = max(delSeq, coveringSeq((*it)->RangeDel, key, seq));
         for (auto it = cache[i].begin(); it != cache[i].end(); ++it)
         {
-            int pos = (*it)->search(key);
+            PERF_COUNT(tablesVisited[min(i, STATS_LEVELS - 1)], 1);
+            std::shared_ptr<TableBlocks> blocks;
+            int pos = (*it)->search(key, seq, blocks, stats.get());
             if (pos == -1)
                 continue;
-            std::ifstream file((*it)->path, std::ios::binary);
-            if (!file)
+            const INDEX &index = blocks->Index[pos];
+            if (index.Seq < delSeq)
             {
-                printf("Lost file: %s", ((*it)->path).c_str());
-                exit(-1);
+                if (cached)
+                    rowCache->insert(key, nullptr, fillSeq);
+                stats->recordTick(GET_MISS);
+                return false;
             }
-            std::string value;
-            uint32_t length, offset = (*it)->Index[pos].Offset;
-            file.seekg(offset);
-            if ((uint32_t)pos == ((*it)->Index).size() - 1)
-                file >> value;
-            else
+            uint32_t length = (*it)->valueLength(blocks.get(), pos);
+            if ((*it)->mapping)
             {
-                uint32_t nextOffset = (*it)->Index[pos + 1].Offset;
-                length = nextOffset - offset;
-                char *result = new char[length + 1];
-                result[length] = '\0';
-                file.read(result, length);
-                value = result;
-                delete[] result;
+                value->pin((*it)->mapping->data + index.Offset, length, (*it)->mapping);
+                if (verifyMappedReads)
+                    (*it)->checkValue(index, value->data(), length);
             }
-            file.close();
-            if (value != "~DELETED~")
-                return value;
             else
-                return "";
+            {
+                PERF_TIMER_START(openTimer, fileOpenNanos);
+                std::ifstream file((*it)->path, std::ios::binary);
+                PERF_TIMER_STOP(openTimer);
+                if (!file)
+                {
+                    printf("Lost file: %s", ((*it)->path).c_str());
+                    exit(-1);
+                }
+                file.seekg(index.Offset);
+                PERF_TIMER_START(readTimer, readNanos);
+                file.read(value->allocate(length), length);
+                PERF_TIMER_STOP(readTimer);
+                (*it)->checkValue(index, value->data(), length);
+            }
+            PERF_COUNT(reads, 1);
+            PERF_COUNT(bytesRead, length);
+            stats->recordTick(TABLE_BYTES_READ, length);
+            if (value->equals("~DELETED~"))
+            {
+                value->reset();
+                if (cached)
+                    rowCache->insert(key, nullptr, fillSeq);
+                stats->recordTick(GET_MISS);
+                return false;
+            }
+            if (cached)
+                rowCache->insert(key, std::make_shared<const std::string>(value->data(), value->size()), fillSeq);
+            stats->recordTick((Ticker)(GET_HIT_L0 + min(i, STATS_LEVELS - 1)));
+            stats->recordTick(BYTES_READ, 8 + value->size());
+            return true;
         }
+        if (delSeq > 0)
+            break;
     }
-    return "";
+    if (cached)
+        rowCache->insert(key, nullptr, fillSeq);
+    stats->recordTick(GET_MISS);
+    return false;
 }
 /**
  * Delete the given key-value pair if it exists.
@@ -151,6 +277,7 @@ std::string KVStore::get(uint64_t key)
  */
 bool KVStore::del(uint64_t key)
 {
+    StopWatch watch(stats.get(), DEL_LATENCY);
     std::string val = get(key);
     if (val == "")
         return false;
@@ -159,33 +286,75 @@ bool KVStore::del(uint64_t key)
 }
 
 /**
- * This resets the kvstore. All key-value pairs should be removed,
- * including memtable and all sstables files.
+ * Delete all key-value pairs whose key lies in [key1, key2].
+ * Only a single range tombstone is recorded, keys are not visited.
  */
-void KVStore::reset()
+void KVStore::deleteRange(uint64_t key1, uint64_t key2)
 {
-    delete memTable;
-    memTable = new SkipList();
-    string filePath = "";
-    for (auto it1 = cache.begin(); it1 != cache.end(); ++it1)
+    if (key1 > key2)
+        return;
+    std::lock_guard<std::mutex> lock(writeMutex);
+    std::vector<range> rangeDel = *current->memTable->RangeDel;
+    rangeDel.push_back(range(key1, key2));
+    if (current->memTable->cacheSize + metaSize(rangeDel, current->memTable->length, levelWriteOptions(0)) > MAX_TABLE_SIZE)
+        flushStalled();
+    uint64_t seq = lastSequence + 1;
+    current->memTable->addRangeDel(key1, key2, seq);
+    lastSequence = seq;
+    if (rowCache)
+        rowCache->eraseRange(key1, key2, seq);
+    // live snapshots may still read the tables the tombstone hides
+    if (!snapshots.empty())
+        return;
+    // every table on disk is older than the tombstone, so fully covered ones go away now
+    std::shared_ptr<Version> version = std::make_shared<Version>(*current);
+    for (uint32_t i = 0; i < version->cache.size(); ++i)
     {
-        for (auto it2 = (*it1).begin(); it2 != (*it1).end(); ++it2)
+        std::vector<std::shared_ptr<SSTableCache>> &tables = version->cache[i];
+        std::vector<std::shared_ptr<SSTableCache>> covered;
+        for (auto it = tables.begin(); it != tables.end();)
         {
-
-            utils::rmfile((*it2)->path.c_str());
-            if(filePath == "")
+            if (key1 <= ((*it)->Header).min && ((*it)->Header).max <= key2)
             {
-                 filePath = (*it2)->path;
-                 int pos = filePath.rfind('/');
-                 filePath = filePath.substr(0,pos);
+                (*it)->obsolete = true;
+                covered.push_back(*it);
+                it = tables.erase(it);
             }
-            delete (*it2);
+            else
+                ++it;
         }
-        utils::rmdir(filePath.c_str());
-        filePath = "";
+        tablesDeleted(covered, i);
+    }
+    install(version);
+}
+
+/**
+ * This resets the kvstore. All key-value pairs should be removed,
+ * including memtable and all sstables files.
+ */
+void KVStore::reset()
+{
+    std::lock_guard<std::mutex> lock(writeMutex);
+    uint32_t levelNum = current->cache.size();
+    for (uint32_t i = 0; i < levelNum; ++i)
+    {
+        for (auto it = current->cache[i].begin(); it != current->cache[i].end(); ++it)
+            (*it)->obsolete = true;
+        tablesDeleted(current->cache[i], i);
     }
-    cache.clear();
-    cache.push_back(std::vector<SSTableCache *>());
+    std::shared_ptr<Version> version = std::make_shared<Version>();
+    version->memTable = std::make_shared<SkipList>(budget.get(), hashBuckets);
+    version->cache.push_back(std::vector<std::shared_ptr<SSTableCache>>());
+    install(version);
+    // like a write to every key, so reads of the old tables are not cached
+    lastSequence = lastSequence + 1;
+    if (rowCache)
+        rowCache->clear(lastSequence);
+    policy->reset();
+    // directories still holding tables pinned by readers are left behind
+    for (uint32_t i = 0; i < levelNum; ++i)
+        utils::rmdir((dataDir + "/level-" + std::to_string(i)).c_str());
+    utils::mkdir((dataDir + "/level-0").c_str());
 }
 
 /**
@@ -195,133 +364,706 @@ void KVStore::reset()
  */
 void KVStore::scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list)
 {
-    memTable->scanSearch(key1, key2, list);
+    scan(key1, key2, list, nullptr);
+}
+
+/**
+ * Same as scan above, but reads the store as seen by the snapshot.
+ */
+void KVStore::scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list, const Snapshot *snapshot)
+{
+    StopWatch watch(stats.get(), SCAN_LATENCY);
+    std::shared_ptr<Version> version = std::atomic_load(&current);
+    uint64_t seq = snapshot ? snapshot->sequence : lastSequence.load();
+    std::vector<std::vector<std::shared_ptr<SSTableCache>>> &cache = version->cache;
+    // sources are visited from newest to oldest, the first value seen for a key wins
+    std::map<uint64_t, std::string> result;
+    std::vector<range> deleted;
+    std::shared_ptr<const std::vector<range>> memRangeDel = version->memTable->getRangeDel();
+    for (auto it = memRangeDel->begin(); it != memRangeDel->end(); ++it)
+    {
+        if ((*it).seq <= seq)
+            deleted.push_back(*it);
+    }
+    std::list<ENTRY> memList;
+    PERF_TIMER_START(memtableTimer, memtableNanos);
+    version->memTable->scanSearch(key1, key2, seq, memList);
+    PERF_TIMER_STOP(memtableTimer);
+    for (auto it = memList.begin(); it != memList.end(); ++it)
+    {
+        if (coveringSeq(deleted, (*it).key, seq) < (*it).seq)
+            result[(*it).key] = (*it).val;
+    }
     int levelNum = cache.size();
     for (int i = 0; i < levelNum; ++i)
     {
         for (auto it = cache[i].begin(); it != cache[i].end(); ++it)
         {
-
-            int pos = (*it)->lowpos(key1, key2);
+            for (auto rt = (*it)->RangeDel.begin(); rt != (*it)->RangeDel.end(); ++rt)
+            {
+                if ((*rt).seq <= seq)
+                    deleted.push_back(*rt);
+            }
+        }
+        for (auto it = cache[i].begin(); it != cache[i].end(); ++it)
+        {
+            PERF_COUNT(tablesVisited[min(i, STATS_LEVELS - 1)], 1);
+            std::shared_ptr<TableBlocks> blocks;
+            int pos = (*it)->lowpos(key1, key2, blocks, stats.get());
             if (pos == -1)
                 continue;
+            PERF_TIMER_START(openTimer, fileOpenNanos);
             std::ifstream file((*it)->path, std::ios::binary);
+            PERF_TIMER_STOP(openTimer);
             if (!file)
             {
                 printf("Lost file: %s", ((*it)->path).c_str());
                 exit(-1);
             }
-            while (true)
+            bool seen = false;
+            uint64_t lastKey = 0;
+            for (;; ++pos)
             {
-                uint64_t key = (*it)->Index[pos].Key;
-                if (key <= key2 && key >= key1)
+                // the range may go on in the next partition of the index
+                if ((uint32_t)pos == blocks->Index.size())
                 {
-                    string value;
-                    uint32_t length, offset = (*it)->Index[pos].Offset;
-                    file.seekg(offset);
-                    if ((uint32_t)pos == ((*it)->Index).size() - 1)
-                    {
-                        file >> value;
-                        list.push_back(std::pair<uint64_t, std::string>(key, value));
+                    if (!(*it)->nextBlocks(blocks, stats.get()))
                         break;
-                    }
-                    uint32_t nextOffset = (*it)->Index[pos + 1].Offset;
-                    length = nextOffset - offset;
-                    char *result = new char[length + 1];
-                    result[length] = '\0';
-                    file.read(result, length);
-                    value = result;
-                    delete[] result;
-                    list.push_back(std::pair<uint64_t, std::string>(key, value));
-                    ++pos;
+                    pos = 0;
                 }
-                else
+                const INDEX &index = blocks->Index[pos];
+                if (index.Key > key2)
                     break;
+                if (index.Seq > seq || (seen && index.Key == lastKey))
+                    continue;
+                seen = true;
+                lastKey = index.Key;
+                if (result.count(index.Key) || coveringSeq(deleted, index.Key, seq) > index.Seq)
+                    continue;
+                uint32_t length = (*it)->valueLength(blocks.get(), pos);
+                file.seekg(index.Offset);
+                char *value = new char[length + 1];
+                value[length] = '\0';
+                PERF_TIMER_START(readTimer, readNanos);
+                file.read(value, length);
+                PERF_TIMER_STOP(readTimer);
+                (*it)->checkValue(index, value, length);
+                PERF_COUNT(reads, 1);
+                PERF_COUNT(bytesRead, length);
+                result[index.Key] = value;
+                delete[] value;
+                stats->recordTick(TABLE_BYTES_READ, length);
             }
         }
     }
-    list.sort(cmp_list);
+    for (auto it = result.begin(); it != result.end(); ++it)
+    {
+        if ((*it).second != "~DELETED~")
+        {
+            list.push_back(*it);
+            stats->recordTick(KEYS_READ);
+            stats->recordTick(BYTES_READ, 8 + (*it).second.size());
+        }
+    }
 }
 
-void KVStore::compact()
+/**
+ * Returns a read view of the current state of the store.
+ * It must be handed back with releaseSnapshot().
+ */
+const Snapshot *KVStore::getSnapshot()
 {
-    uint64_t levelMax = 1;
-    uint32_t levelNum = cache.size();
-    for (uint32_t i = 0; i < levelNum; ++i)
+    std::lock_guard<std::mutex> lock(writeMutex);
+    snapshots.insert(lastSequence);
+    return new Snapshot(lastSequence);
+}
+
+void KVStore::releaseSnapshot(const Snapshot *snapshot)
+{
+    std::lock_guard<std::mutex> lock(writeMutex);
+    snapshots.erase(snapshots.find(snapshot->sequence));
+    delete snapshot;
+}
+
+/**
+ * Returns a named property of the store, or an empty string for an
+ * unknown name. "stats" describes every level, the amplification so far
+ * and all tickers and latency histograms. "memory" shows the filter and
+ * index bytes each level keeps pinned, the bits per key new tables of
+ * each level get under a filter budget, and the usage of the memory budget.
+ */
+std::string KVStore::getProperty(const std::string &name)
+{
+    if (name != "stats" && name != "memory")
+        return "";
+    std::shared_ptr<Version> version = std::atomic_load(&current);
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2);
+    if (name == "memory")
     {
-        levelMax *= 2;
-        if (cache[i].size() > levelMax)
-            compactLevel(i);
-        else
-            break;
+        out << "Level  Tables  Pinned  Index(KB)  Filter(KB)\n";
+        for (uint32_t i = 0; i < version->cache.size(); ++i)
+        {
+            uint64_t pinned = 0, indexBytes = 0, filterBytes = 0;
+            for (auto it = version->cache[i].begin(); it != version->cache[i].end(); ++it)
+            {
+                TableBlocks *blocks = (*it)->blocks.load(std::memory_order_acquire);
+                if (!blocks)
+                    continue;
+                ++pinned;
+                indexBytes += blocks->indexBytes();
+                filterBytes += blocks->filterBytes();
+            }
+            out << std::setw(5) << ("L" + std::to_string(i)) << "  " << std::setw(6) << version->cache[i].size()
+                << "  " << std::setw(6) << pinned << "  " << std::setw(9) << indexBytes / 1024.0
+                << "  " << std::setw(10) << filterBytes / 1024.0 << "\n";
+        }
+        std::vector<uint32_t> filterBits;
+        {
+            std::lock_guard<std::mutex> lock(writeMutex);
+            filterBits = levelFilterBits;
+        }
+        if (!filterBits.empty())
+        {
+            out << "filter bits per key:";
+            for (uint32_t i = 0; i < filterBits.size(); ++i)
+                out << " L" << i << "=" << filterBits[i];
+            out << " (budget " << filterBudgetBits / 8 / 1024.0 << " KB)\n";
+        }
+        out << budget->toString();
+        return out.str();
+    }
+    out << "Level  Files  Size(MB)  Runs  GetHits\n";
+    out << "  mem  " << std::setw(5) << version->memTable->length << " entries"
+        << std::setw(14) << stats->getTickerCount(GET_HIT_MEMTABLE) << "\n";
+    uint64_t totalBytes = 0, lastBytes = 0;
+    for (uint32_t i = 0; i < version->cache.size(); ++i)
+    {
+        uint64_t bytes = levelBytes(version->cache[i]);
+        totalBytes += bytes;
+        if (bytes > 0)
+            lastBytes = bytes;
+        out << std::setw(5) << ("L" + std::to_string(i)) << "  " << std::setw(5) << version->cache[i].size()
+            << "  " << std::setw(8) << bytes / 1048576.0 << "  " << std::setw(4) << runCount(version->cache[i]);
+        // deeper levels share the last hit counter
+        if (i < STATS_LEVELS)
+            out << "  " << std::setw(7) << stats->getTickerCount((Ticker)(GET_HIT_L0 + i));
+        out << "\n";
+    }
+    uint64_t userWritten = stats->getTickerCount(BYTES_WRITTEN);
+    uint64_t userRead = stats->getTickerCount(BYTES_READ);
+    uint64_t tableWritten = stats->getTickerCount(FLUSH_BYTES_WRITTEN) + stats->getTickerCount(COMPACT_BYTES_WRITTEN);
+    // bytes written to tables per byte put, bytes read from tables per byte returned,
+    // and bytes on disk per byte in the last level, which holds roughly the live data
+    out << "write amplification: " << (userWritten ? (double)tableWritten / userWritten : 0) << "\n";
+    out << "read amplification: " << (userRead ? (double)stats->getTickerCount(TABLE_BYTES_READ) / userRead : 0) << "\n";
+    out << "space amplification: " << (lastBytes ? (double)totalBytes / lastBytes : 0) << "\n";
+    if (rowCache)
+    {
+        uint64_t hits = stats->getTickerCount(ROW_CACHE_HIT);
+        uint64_t lookups = hits + stats->getTickerCount(ROW_CACHE_MISS);
+        out << "row cache: " << rowCache->size() << " rows, " << rowCache->getUsage() / 1024.0 << " of "
+            << rowCache->getCapacity() / 1024.0 << " KB, hit rate " << (lookups ? 100.0 * hits / lookups : 0) << "%\n";
+    }
+    {
+        uint64_t hits = stats->getTickerCount(BLOCK_CACHE_HIT);
+        uint64_t lookups = hits + stats->getTickerCount(BLOCK_CACHE_MISS);
+        out << "block cache: " << blockCache->size() << " blocks, " << blockCache->getUsage() / 1024.0 << " of "
+            << blockCache->getCapacity() / 1024.0 << " KB, hit rate " << (lookups ? 100.0 * hits / lookups : 0) << "%\n";
     }
+    out << stats->toString();
+    return out.str();
 }
 
-void KVStore::compactLevel(uint32_t level)
+Statistics *KVStore::getStatistics()
 {
-    std::vector<range> levelRange;
-    std::vector<SSTable> tableCompact;
+    return stats.get();
+}
+
+/**
+ * Appends getProperty("stats") to file every periodSeconds from a
+ * background thread, until called again or the store is closed.
+ * A period of 0 stops dumping.
+ */
+void KVStore::dumpStats(const std::string &file, uint32_t periodSeconds)
+{
+    stopStatsDump();
+    if (periodSeconds == 0)
+        return;
+    stopDump = false;
+    statsDumper = std::thread([this, file, periodSeconds]() {
+        std::unique_lock<std::mutex> lock(dumpMutex);
+        while (!dumpCond.wait_for(lock, std::chrono::seconds(periodSeconds), [this]() { return stopDump; }))
+        {
+            std::ofstream out(file, std::ios::app);
+            out << "** " << std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count()
+                << " **\n"
+                << getProperty("stats") << std::endl;
+        }
+    });
+}
+
+void KVStore::stopStatsDump()
+{
+    if (!statsDumper.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(dumpMutex);
+        stopDump = true;
+    }
+    dumpCond.notify_all();
+    statsDumper.join();
+}
 
-    if (level == 0)
+/**
+ * Read up to tables tables back whole and check them against their
+ * checksums, those the longest since they were last checked first: the
+ * tables found on disk when the store was opened, then the oldest
+ * written since. A table that fails is counted and reported to the
+ * listeners, and stays where it is. Returns how many failed.
+ */
+uint32_t KVStore::scrub(uint32_t tables)
+{
+    std::shared_ptr<Version> version = std::atomic_load(&current);
+    std::vector<std::pair<uint64_t, std::pair<uint32_t, SSTableCache *>>> cold;
+    for (uint32_t i = 0; i < version->cache.size(); ++i)
+    {
+        for (auto it = version->cache[i].begin(); it != version->cache[i].end(); ++it)
+            cold.push_back(std::make_pair((*it)->verified.load(), std::make_pair(i, (*it).get())));
+    }
+    tables = min(tables, (uint32_t)cold.size());
+    std::partial_sort(cold.begin(), cold.begin() + tables, cold.end(),
+                      [](const std::pair<uint64_t, std::pair<uint32_t, SSTableCache *>> &a,
+                         const std::pair<uint64_t, std::pair<uint32_t, SSTableCache *>> &b) { return a.first < b.first; });
+    uint32_t corrupt = 0;
+    for (uint32_t i = 0; i < tables; ++i)
     {
-        for (auto it = cache[level].begin(); it != cache[level].end(); ++it)
+        uint32_t level = cold[i].second.first;
+        SSTableCache *table = cold[i].second.second;
+        bool intact = table->verify(rateLimiter.get());
+        stats->recordTick(TABLES_SCRUBBED);
+        stats->recordTick(SCRUB_BYTES_READ, table->fileSize);
+        if (intact)
+            continue;
+        ++corrupt;
+        stats->recordTick(SCRUB_CORRUPT_TABLES);
+        if (events.active())
         {
-            levelRange.push_back(range((*it)->Header.min, (*it)->Header.max));
-            tableCompact.push_back(SSTable(*it));
+            TableFileInfo info(table->path, level, table->fileSize);
+            events.post([info](EventListener &listener) { listener.onTableFileCorrupted(info); });
         }
-        cache[level].clear();
     }
-    else
+    return corrupt;
+}
+
+/**
+ * Scrub the coldest table every periodSeconds from a background thread,
+ * until called again or the store is closed. A period of 0 stops it.
+ */
+void KVStore::scrubInBackground(uint32_t periodSeconds)
+{
+    stopScrubber();
+    if (periodSeconds == 0)
+        return;
+    stopScrub = false;
+    scrubber = std::thread([this, periodSeconds]() {
+        std::unique_lock<std::mutex> lock(scrubMutex);
+        while (!scrubCond.wait_for(lock, std::chrono::seconds(periodSeconds), [this]() { return stopScrub; }))
+            scrub(1);
+    });
+}
+
+void KVStore::stopScrubber()
+{
+    if (!scrubber.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(scrubMutex);
+        stopScrub = true;
+    }
+    scrubCond.notify_all();
+    scrubber.join();
+}
+
+/**
+ * Publish a new version. Readers that already loaded the old one keep
+ * using it until they are done.
+ */
+void KVStore::install(const std::shared_ptr<Version> &version)
+{
+    // blocks retired from now on must outlive the readers of the old version
+    version->retired = std::make_shared<RetiredBlocks>();
+    current->retired->next = version->retired;
+    std::atomic_store(&current, version);
+    // new tables follow the level sizes as they are now
+    if (filterBudgetBits > 0)
+        levelFilterBits = allocateFilterBits(version->cache, filterBudgetBits, filterType, filterTypeLevel);
+}
+
+// a memtable worth a table of its own goes early while the budget is exceeded
+bool KVStore::overBudget()
+{
+    return current->memTable->arenaBytes >= EARLY_FLUSH_BYTES && budget->exceeded();
+}
+
+/**
+ * Shed the block cache, then unpin filters and indexes, deepest level
+ * first, until what is freed makes up for the bytes the budget is
+ * exceeded by. Cached blocks go first, they were read less recently than
+ * the pinned ones are used. Unpinned blocks are freed once the readers of
+ * the versions that still show them pinned are gone, later lookups read
+ * them through the block cache. Write lock held.
+ */
+void KVStore::enforceBudget()
+{
+    uint64_t excess = budget->excess();
+    if (excess == 0)
+        return;
+    uint64_t unpinned = blockCache->shed(excess);
+    if (unpinned >= excess)
+        return;
+    excess -= unpinned;
+    unpinned = 0;
+    std::vector<std::vector<std::shared_ptr<SSTableCache>>> &cache = current->cache;
+    for (uint32_t i = cache.size(); i-- > 0 && unpinned < excess;)
+    {
+        for (auto it = cache[i].begin(); it != cache[i].end() && unpinned < excess; ++it)
+        {
+            if (!(*it)->pinned)
+                continue;
+            std::shared_ptr<TableBlocks> blocks = (*it)->unpin(blockCache.get());
+            unpinned += blocks->filterBytes() + blocks->indexBytes();
+            current->retired->blocks.push_back(blocks);
+        }
+    }
+    if (unpinned > 0)
+        install(std::make_shared<Version>(*current));
+}
+
+/**
+ * A flush on behalf of a writer, which waits for it and the compactions
+ * it triggers while holding the write lock.
+ */
+void KVStore::flushStalled()
+{
+    if (events.active())
+        events.post([](EventListener &listener) { listener.onStallConditionsChanged({STALL_STOPPED, STALL_NORMAL}); });
+    flush();
+    if (events.active())
+        events.post([](EventListener &listener) { listener.onStallConditionsChanged({STALL_NORMAL, STALL_STOPPED}); });
+}
+
+void KVStore::flush()
+{
+    std::shared_ptr<Version> version = std::make_shared<Version>(*current);
+    std::vector<std::shared_ptr<SSTableCache>> &level0 = version->cache[0];
+    FlushJobInfo info;
+    if (events.active())
+    {
+        info.entries = current->memTable->length;
+        info.rangeTombstones = current->memTable->RangeDel->size();
+        events.post([info](EventListener &listener) { listener.onFlushBegin(info); });
+    }
+    {
+        StopWatch watch(stats.get(), FLUSH_LATENCY);
+        level0.push_back(std::shared_ptr<SSTableCache>(current->memTable->transform(dataDir + "/level-0", currentTime++, snapshots, levelWriteOptions(0))));
+        level0.back()->setBlockCache(blockCache.get());
+        level0.back()->setBudget(budget.get());
+        info.micros = watch.elapsed() / 1000;
+    }
+    stats->recordTick(FLUSH_COUNT);
+    stats->recordTick(FLUSH_BYTES_WRITTEN, level0.back()->fileSize);
+    if (events.active())
+    {
+        info.path = level0.back()->path;
+        info.fileSize = level0.back()->fileSize;
+        TableFileInfo file(info.path, 0, info.fileSize);
+        events.post([file](EventListener &listener) { listener.onTableFileCreated(file); });
+        events.post([info](EventListener &listener) { listener.onFlushCompleted(info); });
+    }
+    std::sort(level0.begin(), level0.end(), cacheTimeCompare);
+    version->memTable = std::make_shared<SkipList>(budget.get(), hashBuckets);
+    install(version);
+    compact();
+    enforceBudget();
+}
+
+void KVStore::compact()
+{
+    CompactionJob job;
+    while (policy->pick(*current, job) && !job.inputs.empty())
+    {
+        compactLevel(job);
+        job = CompactionJob();
+    }
+}
+
+void KVStore::compactLevel(const CompactionJob &job)
+{
+    StopWatch watch(stats.get(), COMPACTION_LATENCY);
+    stats->recordTick(COMPACTION_COUNT);
+    std::shared_ptr<Version> version = std::make_shared<Version>(*current);
+    std::vector<std::vector<std::shared_ptr<SSTableCache>>> &cache = version->cache;
+    std::vector<std::shared_ptr<SSTableCache>> inputs;
+    std::vector<SSTableCache *> reads;
+    std::vector<range> levelRange;
+    std::vector<range> levelRangeDel;
+
+    uint32_t level = job.level;
+    for (auto it = job.inputs.begin(); it != job.inputs.end(); ++it)
+    {
+        std::shared_ptr<SSTableCache> &table = cache[level][*it];
+        levelRange.push_back(range((table->Header).min, (table->Header).max));
+        levelRangeDel.insert(levelRangeDel.end(), table->RangeDel.begin(), table->RangeDel.end());
+        reads.push_back(table.get());
+        inputs.push_back(table);
+    }
+    for (auto it = inputs.begin(); it != inputs.end(); ++it)
+        cache[level].erase(std::find(cache[level].begin(), cache[level].end(), *it));
+    if (!job.sameLevel)
+        ++level;
+    if (level == cache.size())
+    {
+        utils::mkdir((dataDir + "/level-" + std::to_string(level)).c_str());
+        cache.push_back(std::vector<std::shared_ptr<SSTableCache>>());
+    }
+    std::string levelDir = dataDir + "/level-" + std::to_string(level);
+    CompactionJobInfo info;
+    info.inputLevel = job.level;
+    info.outputLevel = level;
+
+    // older runs left in the output level still need the tombstones
+    bool bottom = job.mergeOutputLevel || cache[level].empty();
+    for (uint32_t i = level + 1; i < cache.size(); ++i)
+    {
+        if (!cache[i].empty())
+            bottom = false;
+    }
+
+    // inputs that overlap neither each other nor anything below are moved as
+    // they are, unless they reach the bottom carrying tombstones to drop
+    bool overlapped = job.sameLevel || !disjointRanges(levelRange);
+    for (auto it = inputs.begin(); bottom && it != inputs.end(); ++it)
+    {
+        if ((*it)->tombstones > 0 || !(*it)->RangeDel.empty())
+            overlapped = true;
+    }
+    for (auto it = cache[level].begin(); job.mergeOutputLevel && it != cache[level].end(); ++it)
+    {
+        if (haveIntersection((*it).get(), levelRange))
+            overlapped = true;
+    }
+    // a tiered level counts runs by timestamp, so only a single run may move there
+    for (auto it = inputs.begin(); !job.mergeOutputLevel && it != inputs.end(); ++it)
+    {
+        if (((*it)->Header).timestamp != (inputs[0]->Header).timestamp)
+            overlapped = true;
+    }
+    if (!overlapped)
     {
-        uint64_t mid = 1 << level;
-        auto it = cache[level].begin();
-        for (uint64_t i = 0; i < mid; ++i)
-            ++it;
-        uint64_t newTime = ((*it)->Header).timestamp;
-        while (it != cache[level].begin())
+        std::vector<std::shared_ptr<SSTableCache>> moved;
+        for (auto it = inputs.begin(); it != inputs.end(); ++it)
         {
-            if (((*it)->Header).timestamp > newTime)
+            SSTableCache *link = (*it)->relink(levelDir);
+            if (!link)
                 break;
-            --it;
+            link->setBudget(budget.get());
+            moved.push_back(std::shared_ptr<SSTableCache>(link));
         }
-        if (((*it)->Header).timestamp > newTime)
-            ++it;
-        while (it != cache[level].end())
+        if (moved.size() == inputs.size())
         {
-            levelRange.push_back(range(((*it)->Header).min, ((*it)->Header).max));
-            tableCompact.push_back(SSTable(*it));
-            it = cache[level].erase(it);
+            cache[level].insert(cache[level].end(), moved.begin(), moved.end());
+            std::sort(cache[level].begin(), cache[level].end(), cacheTimeCompare);
+            for (auto it = inputs.begin(); it != inputs.end(); ++it)
+                (*it)->obsolete = true;
+            install(version);
+            stats->recordTick(TRIVIAL_MOVE_COUNT);
+            if (events.active())
+            {
+                info.trivialMove = true;
+                for (auto it = inputs.begin(); it != inputs.end(); ++it)
+                    info.inputFiles.push_back((*it)->path);
+                events.post([info](EventListener &listener) { listener.onCompactionBegin(info); });
+                for (auto it = moved.begin(); it != moved.end(); ++it)
+                {
+                    info.outputFiles.push_back((*it)->path);
+                    TableFileInfo file((*it)->path, level, (*it)->fileSize);
+                    events.post([file](EventListener &listener) { listener.onTableFileCreated(file); });
+                }
+                tablesDeleted(inputs, job.level);
+                info.micros = watch.elapsed() / 1000;
+                events.post([info](EventListener &listener) { listener.onCompactionCompleted(info); });
+            }
+            return;
         }
+        // the file system refused a link, rewrite instead
+        for (auto it = moved.begin(); it != moved.end(); ++it)
+            (*it)->obsolete = true;
     }
-    ++level;
-    if (level < cache.size())
+
+    if (job.mergeOutputLevel)
     {
         for (auto it = cache[level].begin(); it != cache[level].end();)
         {
-            if (haveIntersection(*it, levelRange))
+            if (haveIntersection((*it).get(), levelRange))
             {
-                tableCompact.push_back(SSTable(*it));
+                // a table hidden entirely by a newer range tombstone is dropped unread
+                uint64_t delSeq = containingSeq(levelRangeDel, ((*it)->Header).min, ((*it)->Header).max);
+                bool hidden = delSeq > (*it)->maxSeq && (snapshots.empty() || *snapshots.begin() >= delSeq);
+                if (!hidden)
+                    reads.push_back((*it).get());
+                inputs.push_back(*it);
                 it = cache[level].erase(it);
             }
             else
                 ++it;
         }
     }
-    else
+    if (events.active())
     {
-        utils::mkdir((dataDir + "/level-" + std::to_string(level)).c_str());
-        cache.push_back(std::vector<SSTableCache *>());
+        for (auto it = inputs.begin(); it != inputs.end(); ++it)
+            info.inputFiles.push_back((*it)->path);
+        events.post([info](EventListener &listener) { listener.onCompactionBegin(info); });
     }
-    for (auto it = tableCompact.begin(); it != tableCompact.end(); ++it)
-        utils::rmfile((*it).path.c_str());
-    sort(tableCompact.begin(), tableCompact.end(), tableTimecompare);
-    SSTable::merge(tableCompact);
-    std::vector<SSTableCache *> newCaches = tableCompact[0].save(dataDir + "/level-" + std::to_string(level));
-    for (auto it = newCaches.begin(); it != newCaches.end(); ++it)
+    // each subcompaction merges one key range of every input into its own tables
+    std::vector<uint64_t> bounds = splitInputs(reads, subcompactions);
+    uint32_t parts = bounds.size() + 1;
+    std::vector<std::vector<SSTableCache *>> outputs(parts);
+    // all parts together form one sorted run, so they share its timestamp
+    uint64_t timeStamp = 0;
+    for (auto it = reads.begin(); it != reads.end(); ++it)
+        timeStamp = max(timeStamp, ((*it)->Header).timestamp);
+    TableWriteOptions outputOptions = levelWriteOptions(level);
+    auto subcompact = [&](uint32_t part) {
+        uint64_t lo = part == 0 ? 0 : bounds[part - 1];
+        uint64_t hi = part == parts - 1 ? UINT64_MAX : bounds[part] - 1;
+        std::vector<SSTable> tableCompact;
+        for (auto it = reads.begin(); it != reads.end(); ++it)
+        {
+            if (((*it)->Header).max >= lo && ((*it)->Header).min <= hi)
+                tableCompact.push_back(SSTable(*it, rateLimiter.get(), lo, hi));
+        }
+        if (tableCompact.empty())
+            return;
+        sort(tableCompact.begin(), tableCompact.end(), tableTimecompare);
+        SSTable::merge(tableCompact);
+        tableCompact[0].purge(snapshots, bottom);
+        tableCompact[0].timeStamp = timeStamp;
+        outputs[part] = tableCompact[0].save(levelDir, outputOptions, part, parts);
+    };
+    std::vector<std::thread> workers;
+    for (uint32_t i = 1; i < parts; ++i)
+        workers.push_back(std::thread(subcompact, i));
+    subcompact(0);
+    for (auto it = workers.begin(); it != workers.end(); ++it)
+        (*it).join();
+
+    for (auto it = reads.begin(); it != reads.end(); ++it)
+        info.bytesRead += (*it)->fileSize;
+    for (auto it1 = outputs.begin(); it1 != outputs.end(); ++it1)
     {
-        cache[level].push_back(*it);
+        for (auto it2 = (*it1).begin(); it2 != (*it1).end(); ++it2)
+        {
+            info.bytesWritten += (*it2)->fileSize;
+            info.outputFiles.push_back((*it2)->path);
+            (*it2)->setBlockCache(blockCache.get());
+            (*it2)->setBudget(budget.get());
+            cache[level].push_back(std::shared_ptr<SSTableCache>(*it2));
+        }
     }
+    stats->recordTick(COMPACT_BYTES_READ, info.bytesRead);
+    stats->recordTick(COMPACT_BYTES_WRITTEN, info.bytesWritten);
     std::sort(cache[level].begin(), cache[level].end(), cacheTimeCompare);
+    for (auto it = inputs.begin(); it != inputs.end(); ++it)
+        (*it)->obsolete = true;
+    install(version);
+    if (events.active())
+    {
+        for (auto it1 = outputs.begin(); it1 != outputs.end(); ++it1)
+        {
+            for (auto it2 = (*it1).begin(); it2 != (*it1).end(); ++it2)
+            {
+                TableFileInfo file((*it2)->path, level, (*it2)->fileSize);
+                events.post([file](EventListener &listener) { listener.onTableFileCreated(file); });
+            }
+        }
+        // the first inputs came from the compacted level, the rest from the output level
+        uint32_t upper = job.inputs.size();
+        tablesDeleted(std::vector<std::shared_ptr<SSTableCache>>(inputs.begin(), inputs.begin() + upper), job.level);
+        tablesDeleted(std::vector<std::shared_ptr<SSTableCache>>(inputs.begin() + upper, inputs.end()), level);
+        info.micros = watch.elapsed() / 1000;
+        events.post([info](EventListener &listener) { listener.onCompactionCompleted(info); });
+    }
+}
+
+void KVStore::tablesDeleted(const std::vector<std::shared_ptr<SSTableCache>> &tables, uint32_t level)
+{
+    if (!events.active())
+        return;
+    for (auto it = tables.begin(); it != tables.end(); ++it)
+    {
+        TableFileInfo file((*it)->path, level, (*it)->fileSize);
+        events.post([file](EventListener &listener) { listener.onTableFileDeleted(file); });
+    }
+}
+
+/**
+ * How tables written into level are written: the levels from
+ * filterTypeLevel down get filters of filterType, those above Bloom.
+ * With a filter budget the bits per key are those tuned for the level.
+ */
+TableWriteOptions KVStore::levelWriteOptions(uint32_t level) const
+{
+    TableWriteOptions options = writeOptions;
+    options.filterType = level >= filterTypeLevel ? filterType : BLOOM_FILTER;
+    if (!levelFilterBits.empty())
+    {
+        uint32_t bits = levelFilterBits[min(level, (uint32_t)levelFilterBits.size() - 1)];
+        // partitioned tables are read through their partition filters only
+        if (options.indexPartitionEntries > 0)
+            options.partitionFilterBitsPerKey = bits;
+        else
+            options.filterBitsPerKey = bits;
+    }
+    return options;
+}
+
+void KVStore::addListener(const std::shared_ptr<EventListener> &listener)
+{
+    events.addListener(listener);
+}
+
+MemoryBudget *KVStore::getMemoryBudget()
+{
+    return budget.get();
+}
+
+/**
+ * Pick up to parts - 1 split keys among the smallest keys of the tables,
+ * so that every range gets about the same number of input bytes.
+ */
+std::vector<uint64_t> splitInputs(const std::vector<SSTableCache *> &tables, uint32_t parts)
+{
+    std::vector<uint64_t> bounds;
+    if (parts <= 1 || tables.size() <= 1)
+        return bounds;
+    std::vector<std::pair<uint64_t, uint64_t>> starts;
+    uint64_t total = 0;
+    for (auto it = tables.begin(); it != tables.end(); ++it)
+    {
+        starts.push_back(std::make_pair(((*it)->Header).min, (*it)->fileSize));
+        total += (*it)->fileSize;
+    }
+    std::sort(starts.begin(), starts.end());
+    uint64_t seen = 0;
+    for (auto it = starts.begin(); it != starts.end() && bounds.size() + 1 < parts; ++it)
+    {
+        uint64_t last = bounds.empty() ? starts.front().first : bounds.back();
+        if ((*it).first > last && seen * parts >= total * (bounds.size() + 1))
+            bounds.push_back((*it).first);
+        seen += (*it).second;
+    }
+    return bounds;
 }
 
 bool cmp_list(std::pair<uint64_t, std::string> x1, std::pair<uint64_t, std::string> x2)
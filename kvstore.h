@@ -2,23 +2,109 @@
 
 #include "kvstore_api.h"
 #include "skiplist.h"
+#include "compaction.h"
+#include "statistics.h"
+#include "eventlistener.h"
+#include "memorybudget.h"
+#include "rowcache.h"
+#include "blockcache.h"
+#include "pinnableslice.h"
 #include <vector>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <memory>
+
+// while over the memory budget, a memtable of this many bytes is flushed early
+#define EARLY_FLUSH_BYTES (MAX_TABLE_SIZE / 8)
+
+/**
+ * A consistent read view, obtained from KVStore::getSnapshot().
+ * Reads through it only see writes made before it was taken.
+ */
+class Snapshot
+{
+	friend class KVStore;
+	uint64_t sequence;
+	Snapshot(uint64_t seq) : sequence(seq) {}
+};
+
+/**
+ * Filter and index blocks unpinned while a version was current. Readers
+ * of that version or an older one may still use them, so a version keeps
+ * the list of its time and, through next, every later one alive.
+ */
+struct RetiredBlocks
+{
+	std::vector<std::shared_ptr<TableBlocks>> blocks;
+	std::shared_ptr<RetiredBlocks> next;
+};
+
+/**
+ * The memtable and the sstables of every level at one point in time.
+ * A published version is never modified, writers install a new one.
+ * Tables dropped by compaction are unlinked only after the last version
+ * referencing them is gone.
+ */
+struct Version
+{
+	std::shared_ptr<SkipList> memTable;
+	std::vector<std::vector<std::shared_ptr<SSTableCache>>> cache;
+	std::shared_ptr<RetiredBlocks> retired;
+};
 
 class KVStore : public KVStoreAPI
 {
 	// You can add your implementation here
 private:
-//	SkipList *memTable;
-	std::vector<std::vector<SSTableCache *>> cache;
+	std::shared_ptr<Version> current;
 	unsigned long long currentTime;
+	std::atomic<uint64_t> lastSequence;
+	std::multiset<uint64_t> snapshots;
+	std::mutex writeMutex;
 	std::string dataDir;
+	std::shared_ptr<CompactionPolicy> policy;
+	std::shared_ptr<RateLimiter> rateLimiter;
+	TableWriteOptions writeOptions;
+	uint32_t subcompactions;
+	uint32_t hashBuckets;
+	bool verifyMappedReads;
+	FilterType filterType;
+	uint32_t filterTypeLevel;
+	uint64_t filterBudgetBits;
+	// bits per key of the filters of new tables by level, empty unless tuned to the budget
+	std::vector<uint32_t> levelFilterBits;
+	std::shared_ptr<MemoryBudget> budget;
+	std::unique_ptr<RowCache> rowCache;
+	// holds the index partitions of tables read on demand and the filters and indexes of unpinned tables
+	std::unique_ptr<BlockCache> blockCache;
+	std::unique_ptr<Statistics> stats;
+	std::thread statsDumper;
+	std::mutex dumpMutex;
+	std::condition_variable dumpCond;
+	bool stopDump;
+	std::thread scrubber;
+	std::mutex scrubMutex;
+	std::condition_variable scrubCond;
+	bool stopScrub;
+	EventDispatcher events;
 
+	void install(const std::shared_ptr<Version> &version);
+	void flush();
 	void compact();
-    void compactLevel(uint32_t level);
+	void compactLevel(const CompactionJob &job);
+	void stopStatsDump();
+	void stopScrubber();
+	void flushStalled();
+	bool overBudget();
+	void enforceBudget();
+	void tablesDeleted(const std::vector<std::shared_ptr<SSTableCache>> &tables, uint32_t level);
+	TableWriteOptions levelWriteOptions(uint32_t level) const;
 
 public:
-    SkipList *memTable;
-	KVStore(const std::string &dir);
+	KVStore(const std::string &dir, const CompactionOptions &options = CompactionOptions());
 
 	~KVStore();
 
@@ -26,11 +112,39 @@ public:
 
 	std::string get(uint64_t key) override;
 
+	std::string get(uint64_t key, const Snapshot *snapshot);
+
+	bool getPinned(uint64_t key, PinnableSlice *value, const Snapshot *snapshot = nullptr);
+
 	bool del(uint64_t key) override;
 
+	void deleteRange(uint64_t key1, uint64_t key2) override;
+
 	void reset() override;
 
 	void scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list) override;
+
+	void scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list, const Snapshot *snapshot);
+
+	const Snapshot *getSnapshot();
+
+	void releaseSnapshot(const Snapshot *snapshot);
+
+	std::string getProperty(const std::string &name);
+
+	Statistics *getStatistics();
+
+	void dumpStats(const std::string &file, uint32_t periodSeconds);
+
+	uint32_t scrub(uint32_t tables);
+
+	void scrubInBackground(uint32_t periodSeconds);
+
+	void addListener(const std::shared_ptr<EventListener> &listener);
+
+	MemoryBudget *getMemoryBudget();
 };
 
+std::vector<uint64_t> splitInputs(const std::vector<SSTableCache *> &tables, uint32_t parts);
+
 bool cmp_list(std::pair<uint64_t, std::string> x1, std::pair<uint64_t, std::string> x2);
@@ -1,25 +1,53 @@
-TEMPLATE = app
-CONFIG += console c++11
-CONFIG -= app_bundle
-CONFIG -= qt
-
-SOURCES += \
-    bloomfilter.cpp \
-    correctness.cc \
-    kvstore.cc\
-    persistence.cc \
-    skiplist.cpp \
-    sstable.cpp
-
-HEADERS += \
-    bloomfilter.h \
-    kvstore.h\
-    kvstore_api.h\
-    MurmurHash3.h\
-    skiplist.h \
-    sstable.h \
-    test.h\
-    utils.h
-
-
-
+TEMPLATE = app
+CONFIG += console c++11 thread
+CONFIG -= app_bundle
+CONFIG -= qt
+
+SOURCES += \
+    blockcache.cc \
+    bloomfilter.cpp \
+    compaction.cc \
+    crc32c.cc \
+    eventlistener.cc \
+    filterblock.cc \
+    correctness.cc \
+    kvstore.cc\
+    memorybudget.cc \
+    perfcontext.cc \
+    persistence.cc \
+    rangefilter.cc \
+    ratelimiter.cc \
+    rowcache.cc \
+    shardedkvstore.cc \
+    skiplist.cpp \
+    sstable.cpp \
+    statistics.cc \
+    tablebuilder.cc
+
+HEADERS += \
+    blockcache.h \
+    bloomfilter.h \
+    clockcache.h \
+    compaction.h \
+    crc32c.h \
+    eventlistener.h \
+    filterblock.h \
+    kvstore.h\
+    kvstore_api.h\
+    memorybudget.h \
+    MurmurHash3.h\
+    perfcontext.h \
+    pinnableslice.h \
+    rangefilter.h \
+    ratelimiter.h \
+    rowcache.h \
+    shardedkvstore.h \
+    skiplist.h \
+    sstable.h \
+    statistics.h \
+    tablebuilder.h \
+    test.h\
+    utils.h
+
+
+
@@ -0,0 +1,73 @@
+#include "memorybudget.h"
+#include <sstream>
+
+static const char *categoryNames[MEM_CATEGORY_COUNT] = {
+    "memtable",
+    "index",
+    "filter",
+    "cache"};
+
+MemoryBudget::MemoryBudget(uint64_t limit) : limit(limit), total(0)
+{
+    for (uint32_t i = 0; i < MEM_CATEGORY_COUNT; ++i)
+        usage[i].store(0, std::memory_order_relaxed);
+}
+
+void MemoryBudget::charge(MemoryCategory category, int64_t bytes)
+{
+    usage[category].fetch_add(bytes, std::memory_order_relaxed);
+    total.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+// a release may be seen before its charge, never report less than nothing
+uint64_t MemoryBudget::getUsage(MemoryCategory category) const
+{
+    int64_t bytes = usage[category].load(std::memory_order_relaxed);
+    return bytes > 0 ? bytes : 0;
+}
+
+uint64_t MemoryBudget::getTotal() const
+{
+    int64_t bytes = total.load(std::memory_order_relaxed);
+    return bytes > 0 ? bytes : 0;
+}
+
+void MemoryBudget::setLimit(uint64_t bytes)
+{
+    limit.store(bytes, std::memory_order_relaxed);
+}
+
+uint64_t MemoryBudget::getLimit() const
+{
+    return limit.load(std::memory_order_relaxed);
+}
+
+uint64_t MemoryBudget::excess() const
+{
+    uint64_t max = getLimit();
+    uint64_t used = getTotal();
+    return max > 0 && used > max ? used - max : 0;
+}
+
+uint64_t MemoryBudget::room() const
+{
+    uint64_t max = getLimit();
+    uint64_t used = getTotal();
+    if (max == 0)
+        return UINT64_MAX;
+    return used < max ? max - used : 0;
+}
+
+std::string MemoryBudget::toString() const
+{
+    std::ostringstream out;
+    for (uint32_t i = 0; i < MEM_CATEGORY_COUNT; ++i)
+        out << categoryNames[i] << " BYTES : " << getUsage((MemoryCategory)i) << "\n";
+    out << "total BYTES : " << getTotal() << " LIMIT : " << getLimit() << "\n";
+    return out.str();
+}
+
+const char *MemoryBudget::categoryName(MemoryCategory category)
+{
+    return categoryNames[category];
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <string>
+
+enum MemoryCategory
+{
+	MEM_MEMTABLE = 0,
+	MEM_INDEX,
+	MEM_FILTER,
+	MEM_CACHE,
+	MEM_CATEGORY_COUNT
+};
+
+/**
+ * One memory limit for the memtables, the filter and index blocks and the
+ * caches of one or more stores. Whoever allocates charges the bytes and
+ * releases them when they are freed. Once the total is over the limit a
+ * store sheds its block cache, then unpins the filters and indexes of its
+ * deepest levels first, those are then read through the block cache, and
+ * flushes its memtable early. A limit of 0 only accounts.
+ */
+class MemoryBudget
+{
+private:
+	std::atomic<uint64_t> limit;
+	std::atomic<int64_t> usage[MEM_CATEGORY_COUNT];
+	std::atomic<int64_t> total;
+
+public:
+	MemoryBudget(uint64_t limit = 0);
+
+	void charge(MemoryCategory category, int64_t bytes);
+
+	void release(MemoryCategory category, int64_t bytes) { charge(category, -bytes); }
+
+	uint64_t getUsage(MemoryCategory category) const;
+
+	uint64_t getTotal() const;
+
+	void setLimit(uint64_t bytes);
+
+	uint64_t getLimit() const;
+
+	// bytes over the limit, 0 while within it or without a limit
+	uint64_t excess() const;
+
+	bool exceeded() const { return excess() > 0; }
+
+	// bytes left under the limit, UINT64_MAX without a limit
+	uint64_t room() const;
+
+	std::string toString() const;
+
+	static const char *categoryName(MemoryCategory category);
+};
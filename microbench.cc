@@ -0,0 +1,428 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <new>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+
+#include "skiplist.h"
+#include "sstable.h"
+#include "bloomfilter.h"
+#include "utils.h"
+
+/**
+ * Microbenchmarks for the hot kernels in isolation. Each kernel has an
+ * untimed setup and teardown around a timed body that performs `ops`
+ * operations, so ns/op and allocs/op are per key for the lookup kernels
+ * and per entry for merge2 and the two serializers.
+ */
+
+// counts every operator new in the process, measure() samples it around each body
+static std::atomic<uint64_t> allocations(0);
+
+// kept out of line, gcc mistakes the inlined malloc()/free() for a mismatch
+__attribute__((noinline)) void *operator new(std::size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void *operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p) noexcept
+{
+	std::free(p);
+}
+
+struct Kernel
+{
+	std::string name;
+	uint64_t ops;
+	std::function<void()> setup;
+	std::function<void()> body;
+	std::function<void()> teardown;
+};
+
+struct KernelStats
+{
+	std::string name;
+	double min = 0, median = 0, mean = 0, stddev = 0, max = 0; // ns/op
+	double allocs = 0;										  // allocs/op
+};
+
+struct MicroConfig
+{
+	std::string kernels;
+	std::string dir = "./microbench-data";
+	std::string baseline;
+	std::string save;
+	uint64_t num = 10000;
+	uint32_t valueSize = 100;
+	uint32_t warmup = 2;
+	uint32_t reps = 10;
+	double threshold = 10;
+	uint64_t seed = 301;
+};
+
+static KernelStats measure(Kernel &kernel, const MicroConfig &config)
+{
+	std::vector<double> samples;
+	uint64_t allocs = 0;
+	// summed wide, so a large --warmup cannot wrap the count of timed runs to none
+	for (uint64_t rep = 0; rep < (uint64_t)config.warmup + config.reps; ++rep)
+	{
+		if (kernel.setup)
+			kernel.setup();
+		uint64_t before = allocations.load(std::memory_order_relaxed);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		kernel.body();
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		uint64_t after = allocations.load(std::memory_order_relaxed);
+		if (kernel.teardown)
+			kernel.teardown();
+		if (rep < config.warmup)
+			continue;
+		samples.push_back(std::chrono::duration<double, std::nano>(end - start).count() / kernel.ops);
+		allocs += after - before;
+	}
+	KernelStats stats;
+	stats.name = kernel.name;
+	std::sort(samples.begin(), samples.end());
+	uint64_t n = samples.size();
+	stats.min = samples.front();
+	stats.max = samples.back();
+	stats.median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+	for (auto it = samples.begin(); it != samples.end(); ++it)
+		stats.mean += *it / n;
+	for (auto it = samples.begin(); it != samples.end(); ++it)
+		stats.stddev += (*it - stats.mean) * (*it - stats.mean) / n;
+	stats.stddev = std::sqrt(stats.stddev);
+	stats.allocs = (double)allocs / n / kernel.ops;
+	return stats;
+}
+
+/**
+ * Shared inputs for all kernels, built once so that no kernel pays for
+ * generating its keys.
+ */
+class Suite
+{
+private:
+	MicroConfig config;
+	std::string value;
+	std::vector<uint64_t> keys;	   // distinct, random order
+	std::vector<uint64_t> lookups; // half present, half absent
+	std::multiset<uint64_t> snapshots;
+
+	SkipList *list = nullptr;
+	BloomFilter *filter = nullptr;
+	SSTableCache *cache = nullptr;
+
+	// per repetition state, created in setup and released in teardown
+	SkipList *scratchList = nullptr;
+	BloomFilter *scratchFilter = nullptr;
+	SSTable left, right, merged;
+	SSTableCache *saved = nullptr;
+
+	// keeps the lookups from being optimised away
+	volatile uint64_t sink = 0;
+
+	void fillTable(SSTable &table, uint64_t first, uint64_t step)
+	{
+		table = SSTable();
+		table.timeStamp = 1;
+		for (uint64_t i = first; i < config.num; i += step)
+		{
+			ENTRY entry(2 * i, i + 1, value);
+			table.add(entry);
+		}
+	}
+
+	void dropSaved()
+	{
+		// the benchmark tables are scratch files, let the cache remove them
+		saved->obsolete = true;
+		delete saved;
+		saved = nullptr;
+	}
+
+public:
+	Suite(const MicroConfig &config) : config(config), value(config.valueSize, 'v')
+	{
+		std::mt19937_64 rng(config.seed);
+		for (uint64_t i = 0; i < config.num; ++i)
+			keys.push_back(2 * i);
+		std::shuffle(keys.begin(), keys.end(), rng);
+		for (uint64_t i = 0; i < config.num; ++i)
+			lookups.push_back(keys[i] + (rng() & 1));
+
+		list = new SkipList();
+		filter = new BloomFilter();
+		cache = new SSTableCache();
+		for (uint64_t i = 0; i < config.num; ++i)
+		{
+			list->Insert(keys[i], i + 1, value);
+			filter->setBF(keys[i]);
+			cache->pinned->BF->setBF(2 * i);
+			cache->pinned->Index.push_back(INDEX(2 * i, 0, i + 1));
+		}
+		cache->Header.num = config.num;
+		cache->Header.min = 0;
+		cache->Header.max = 2 * (config.num - 1);
+		utils::mkdir(config.dir.c_str());
+	}
+
+	~Suite()
+	{
+		delete list;
+		delete filter;
+		delete cache;
+		utils::rmdir(config.dir.c_str());
+	}
+
+	std::vector<Kernel> kernels()
+	{
+		std::vector<Kernel> all;
+		uint64_t n = config.num;
+
+		all.push_back({"skiplist.insert", n,
+					   [this]() { scratchList = new SkipList(); },
+					   [this]() {
+						   for (uint64_t i = 0; i < keys.size(); ++i)
+							   scratchList->Insert(keys[i], i + 1, value);
+					   },
+					   [this]() { delete scratchList; }});
+		all.push_back({"skiplist.search", n, nullptr,
+					   [this]() {
+						   for (auto it = lookups.begin(); it != lookups.end(); ++it)
+							   sink += list->Search(*it, UINT64_MAX) != nullptr;
+					   },
+					   nullptr});
+		all.push_back({"bloom.setBF", n,
+					   [this]() { scratchFilter = new BloomFilter(); },
+					   [this]() {
+						   for (auto it = keys.begin(); it != keys.end(); ++it)
+							   scratchFilter->setBF(*it);
+					   },
+					   [this]() { delete scratchFilter; }});
+		all.push_back({"bloom.isExisted", n, nullptr,
+					   [this]() {
+						   for (auto it = lookups.begin(); it != lookups.end(); ++it)
+							   sink += filter->isExisted(*it);
+					   },
+					   nullptr});
+		all.push_back({"sstable.find", n, nullptr,
+					   [this]() {
+						   std::shared_ptr<TableBlocks> blocks;
+						   for (auto it = lookups.begin(); it != lookups.end(); ++it)
+							   sink += cache->search(*it, UINT64_MAX, blocks);
+					   },
+					   nullptr});
+		all.push_back({"sstable.lowpos", n, nullptr,
+					   [this]() {
+						   std::shared_ptr<TableBlocks> blocks;
+						   for (auto it = lookups.begin(); it != lookups.end(); ++it)
+							   sink += cache->lowpos(*it, *it + 200, blocks);
+					   },
+					   nullptr});
+		all.push_back({"sstable.merge2", n,
+					   [this]() {
+						   fillTable(left, 0, 2);
+						   fillTable(right, 1, 2);
+					   },
+					   [this]() { merged = SSTable::merge2(left, right); },
+					   [this]() { merged = SSTable(); }});
+		all.push_back({"skiplist.transform", n,
+					   [this]() {
+						   scratchList = new SkipList();
+						   for (uint64_t i = 0; i < keys.size(); ++i)
+							   scratchList->Insert(keys[i], i + 1, value);
+					   },
+					   [this]() { saved = scratchList->transform(config.dir, 1, snapshots); },
+					   [this]() {
+						   dropSaved();
+						   delete scratchList;
+					   }});
+		all.push_back({"sstable.saveSingle", n,
+					   [this]() { fillTable(left, 0, 1); },
+					   [this]() { saved = left.saveSingle(config.dir, 1, 0); },
+					   [this]() {
+						   dropSaved();
+						   left = SSTable();
+					   }});
+		std::vector<Kernel> selected;
+		for (auto it = all.begin(); it != all.end(); ++it)
+		{
+			if (config.kernels.empty() || ("," + config.kernels + ",").find("," + (*it).name + ",") != std::string::npos)
+				selected.push_back(*it);
+		}
+		return selected;
+	}
+};
+
+static std::map<std::string, KernelStats> loadBaseline(const std::string &file)
+{
+	std::map<std::string, KernelStats> baseline;
+	std::ifstream in(file);
+	std::string line;
+	while (std::getline(in, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+		std::istringstream fields(line);
+		KernelStats stats;
+		if (fields >> stats.name >> stats.median >> stats.allocs)
+			baseline[stats.name] = stats;
+	}
+	return baseline;
+}
+
+static void saveBaseline(const std::string &file, const std::vector<KernelStats> &results)
+{
+	std::ofstream out(file);
+	out << "# kernel median_ns_per_op allocs_per_op" << std::endl;
+	for (auto it = results.begin(); it != results.end(); ++it)
+		out << (*it).name << " " << (*it).median << " " << (*it).allocs << std::endl;
+}
+
+// a repetition count, -1 for one that is negative or does not fit
+static int64_t parseCount(const std::string &val)
+{
+	unsigned long long count = std::stoull(val);
+	if (val.find('-') != std::string::npos || count > UINT32_MAX)
+		return -1;
+	return count;
+}
+
+static void usage()
+{
+	std::cout << "Usage: microbench [options]" << std::endl;
+	std::cout << "  --kernels=a,b,...   kernels to run (default: all of skiplist.insert skiplist.search" << std::endl;
+	std::cout << "                      bloom.setBF bloom.isExisted sstable.find sstable.lowpos" << std::endl;
+	std::cout << "                      sstable.merge2 skiplist.transform sstable.saveSingle)" << std::endl;
+	std::cout << "  --num=N             keys per kernel (default 10000)" << std::endl;
+	std::cout << "  --value_size=N      bytes per value (default 100)" << std::endl;
+	std::cout << "  --warmup=N          untimed repetitions (default 2)" << std::endl;
+	std::cout << "  --reps=N            timed repetitions (default 10)" << std::endl;
+	std::cout << "  --dir=PATH          scratch directory for the serializers" << std::endl;
+	std::cout << "  --save=FILE         write the results as a baseline" << std::endl;
+	std::cout << "  --baseline=FILE     compare against a saved baseline" << std::endl;
+	std::cout << "  --threshold=PCT     allowed median slowdown against the baseline (default 10)" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	MicroConfig config;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		std::string::size_type eq = arg.find('=');
+		std::string flag = arg.substr(0, eq);
+		std::string val = eq == std::string::npos ? "" : arg.substr(eq + 1);
+		if (flag == "--kernels")
+			config.kernels = val;
+		else if (flag == "--num")
+			config.num = std::stoull(val);
+		else if (flag == "--value_size")
+			config.valueSize = std::stoul(val);
+		else if (flag == "--warmup" || flag == "--reps")
+		{
+			int64_t count = parseCount(val);
+			if (count < 0)
+			{
+				std::cerr << flag << " must be between 0 and " << UINT32_MAX << std::endl;
+				return 1;
+			}
+			(flag == "--warmup" ? config.warmup : config.reps) = count;
+		}
+		else if (flag == "--dir")
+			config.dir = val;
+		else if (flag == "--save")
+			config.save = val;
+		else if (flag == "--baseline")
+			config.baseline = val;
+		else if (flag == "--threshold")
+			config.threshold = std::stod(val);
+		else
+		{
+			usage();
+			return flag == "--help" ? 0 : 1;
+		}
+	}
+	if (config.num < 2 || config.reps == 0)
+	{
+		std::cerr << "--num must be at least 2 and --reps at least 1" << std::endl;
+		return 1;
+	}
+
+	std::map<std::string, KernelStats> baseline;
+	if (!config.baseline.empty())
+		baseline = loadBaseline(config.baseline);
+
+	std::vector<KernelStats> results;
+	{
+		Suite suite(config);
+		std::vector<Kernel> kernels = suite.kernels();
+		if (kernels.empty())
+		{
+			std::cerr << "no kernel matches --kernels=" << config.kernels << std::endl;
+			return 1;
+		}
+		for (auto it = kernels.begin(); it != kernels.end(); ++it)
+			results.push_back(measure(*it, config));
+	}
+
+	std::printf("Keys: %llu, value size: %u, warm-up: %u, repetitions: %u\n",
+				(unsigned long long)config.num, config.valueSize, config.warmup, config.reps);
+	std::printf("%-20s %10s %10s %10s %10s %10s %10s", "kernel", "min", "median", "mean", "stddev", "max", "allocs/op");
+	if (!baseline.empty())
+		std::printf(" %10s %10s", "base", "change");
+	std::printf("\n");
+
+	int regressions = 0;
+	for (auto it = results.begin(); it != results.end(); ++it)
+	{
+		const KernelStats &s = *it;
+		std::printf("%-20s %10.1f %10.1f %10.1f %10.1f %10.1f %10.2f", s.name.c_str(), s.min, s.median, s.mean, s.stddev, s.max, s.allocs);
+		auto base = baseline.find(s.name);
+		if (base != baseline.end())
+		{
+			double change = (s.median / base->second.median - 1) * 100;
+			// allocation counts are deterministic, any increase is a regression
+			bool regressed = change > config.threshold || s.allocs > base->second.allocs + 1e-9;
+			std::printf(" %10.1f %+9.1f%%%s", base->second.median, change, regressed ? "  REGRESSION" : "");
+			regressions += regressed;
+		}
+		std::printf("\n");
+	}
+	std::printf("(times in ns/op)\n");
+
+	if (!config.save.empty())
+		saveBaseline(config.save, results);
+	if (regressions > 0)
+	{
+		std::printf("%d kernel(s) regressed against %s\n", regressions, config.baseline.c_str());
+		return 2;
+	}
+	return 0;
+}
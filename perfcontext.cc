@@ -0,0 +1,37 @@
+#include "perfcontext.h"
+#include <sstream>
+
+thread_local PerfLevel perfLevel = PERF_DISABLED;
+thread_local PerfContext perfContext = PerfContext();
+
+void PerfContext::reset()
+{
+    *this = PerfContext();
+}
+
+std::string PerfContext::toString() const
+{
+    std::ostringstream out;
+    out << "memtable_nanos = " << memtableNanos << ", tables_visited = [";
+    for (uint32_t i = 0; i < STATS_LEVELS; ++i)
+        out << (i ? " " : "") << tablesVisited[i];
+    out << "], filter_probes = " << filterProbes << ", filter_rejections = " << filterRejections
+        << ", index_steps = " << indexSteps << ", reads = " << reads << ", bytes_read = " << bytesRead
+        << ", file_open_nanos = " << fileOpenNanos << ", read_nanos = " << readNanos;
+    return out.str();
+}
+
+void setPerfLevel(PerfLevel level)
+{
+    perfLevel = level;
+}
+
+PerfLevel getPerfLevel()
+{
+    return perfLevel;
+}
+
+PerfContext *getPerfContext()
+{
+    return &perfContext;
+}
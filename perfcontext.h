@@ -0,0 +1,74 @@
+#pragma once
+
+#include "statistics.h"
+#include <cstdint>
+#include <string>
+
+enum PerfLevel
+{
+	PERF_DISABLED = 0,
+	PERF_ENABLE_COUNT,
+	PERF_ENABLE_TIME
+};
+
+/**
+ * What the last operations of this thread did, for explaining a single
+ * slow get or scan. Counters add up until reset(), times are nanoseconds
+ * and only taken at PERF_ENABLE_TIME. Tables of levels deeper than
+ * STATS_LEVELS - 1 are counted in the last slot.
+ */
+struct PerfContext
+{
+	uint64_t memtableNanos;
+	uint64_t tablesVisited[STATS_LEVELS];
+	uint64_t filterProbes;
+	uint64_t filterRejections;
+	uint64_t indexSteps;
+	uint64_t reads;
+	uint64_t bytesRead;
+	uint64_t fileOpenNanos;
+	uint64_t readNanos;
+
+	void reset();
+	std::string toString() const;
+};
+
+extern thread_local PerfLevel perfLevel;
+extern thread_local PerfContext perfContext;
+
+void setPerfLevel(PerfLevel level);
+PerfLevel getPerfLevel();
+PerfContext *getPerfContext();
+
+class PerfTimer
+{
+private:
+	uint64_t *field;
+	uint64_t start;
+
+public:
+	PerfTimer(uint64_t *field) : field(perfLevel >= PERF_ENABLE_TIME ? field : nullptr), start(this->field ? nowNanos() : 0) {}
+	~PerfTimer() { stop(); }
+	void stop()
+	{
+		if (field)
+			*field += nowNanos() - start;
+		field = nullptr;
+	}
+};
+
+// building with NPERF_CONTEXT leaves no trace of the context on the read path
+#ifdef NPERF_CONTEXT
+#define PERF_COUNT(field, n)
+#define PERF_TIMER_START(timer, field)
+#define PERF_TIMER_STOP(timer)
+#else
+#define PERF_COUNT(field, n)                  \
+	do                                        \
+	{                                         \
+		if (perfLevel >= PERF_ENABLE_COUNT) \
+			perfContext.field += (n);         \
+	} while (0)
+#define PERF_TIMER_START(timer, field) PerfTimer timer(&perfContext.field)
+#define PERF_TIMER_STOP(timer) timer.stop()
+#endif
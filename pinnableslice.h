@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <memory>
+
+/**
+ * A value handed out without copying it. The bytes belong to what the
+ * slice pins, the memtable or the mapped table file, and stay valid until
+ * the slice is reset or destroyed, whatever the store does meanwhile.
+ * A value that cannot be pinned is copied into the slice itself.
+ */
+class PinnableSlice
+{
+private:
+	const char *ptr;
+	size_t length;
+	std::shared_ptr<const void> owner;
+	std::string buffer;
+
+public:
+	PinnableSlice() : ptr(""), length(0) {}
+	PinnableSlice(const PinnableSlice &) = delete;
+	PinnableSlice &operator=(const PinnableSlice &) = delete;
+
+	const char *data() const { return ptr; }
+	size_t size() const { return length; }
+	bool empty() const { return length == 0; }
+	bool pinned() const { return owner != nullptr; }
+	bool equals(const char *s) const { return strlen(s) == length && memcmp(ptr, s, length) == 0; }
+	std::string toString() const { return std::string(ptr, length); }
+
+	void pin(const char *data, size_t size, const std::shared_ptr<const void> &owner)
+	{
+		buffer.clear();
+		ptr = data;
+		length = size;
+		this->owner = owner;
+	}
+
+	// room for a value that has to be copied after all
+	char *allocate(size_t size)
+	{
+		owner.reset();
+		buffer.resize(size);
+		ptr = &buffer[0];
+		length = size;
+		return &buffer[0];
+	}
+
+	void reset()
+	{
+		owner.reset();
+		buffer.clear();
+		ptr = "";
+		length = 0;
+	}
+};
@@ -0,0 +1,202 @@
+#include "rangefilter.h"
+#include <algorithm>
+#include <cstring>
+
+const uint32_t RangeFilter::BLOCK;
+const uint32_t RangeFilter::NO_FILTER;
+
+static uint32_t bitWidth(uint64_t value)
+{
+    uint32_t width = 0;
+    while (width < 64 && value >> width)
+        ++width;
+    return width;
+}
+
+static uint64_t align8(uint64_t bytes)
+{
+    return (bytes + 7) / 8 * 8;
+}
+
+uint64_t RangeFilter::byteSize(uint64_t num, uint32_t bitsPerKey)
+{
+    return 16 + (num * bitsPerKey + 63) / 64 * 8;
+}
+
+// bytes of the filter cut at shift: header, block directory and deltas
+uint64_t RangeFilter::packedSize(const std::vector<uint64_t> &keys, uint32_t shift)
+{
+    uint64_t blocks = 0, bits = 0, inBlock = 0, maxDelta = 0, last = 0;
+    for (uint64_t i = 0; i < keys.size(); ++i)
+    {
+        uint64_t prefix = keys[i] >> shift;
+        if (i > 0 && prefix == last)
+            continue;
+        if (inBlock == BLOCK)
+        {
+            bits += (BLOCK - 1) * bitWidth(maxDelta);
+            inBlock = 0;
+        }
+        if (inBlock == 0)
+        {
+            ++blocks;
+            maxDelta = 0;
+        }
+        else
+            maxDelta = std::max(maxDelta, prefix - last);
+        ++inBlock;
+        last = prefix;
+    }
+    bits += inBlock > 0 ? (inBlock - 1) * bitWidth(maxDelta) : 0;
+    return 16 + align8(13 * blocks) + (bits + 63) / 64 * 8;
+}
+
+RangeFilter::RangeFilter(const std::vector<uint64_t> &keys, uint32_t bitsPerKey) : count(0), budget(nullptr)
+{
+    size = byteSize(keys.size(), bitsPerKey);
+    // fewer bits dropped, fewer false positives; the smallest cut that fits
+    shift = NO_FILTER;
+    if (packedSize(keys, NO_FILTER - 1) <= size)
+    {
+        uint32_t lo = 0, hi = NO_FILTER - 1;
+        while (lo < hi)
+        {
+            uint32_t mid = (lo + hi) / 2;
+            if (packedSize(keys, mid) <= size)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        shift = hi;
+    }
+    if (shift == NO_FILTER)
+        return;
+
+    uint64_t bitPos = 0;
+    std::vector<uint64_t> block;
+    block.reserve(BLOCK);
+    for (uint64_t i = 0; i <= keys.size(); ++i)
+    {
+        uint64_t prefix = i < keys.size() ? keys[i] >> shift : 0;
+        if (i < keys.size() && !block.empty() && prefix == block.back())
+            continue;
+        if (block.size() == BLOCK || (i == keys.size() && !block.empty()))
+        {
+            uint64_t maxDelta = 0;
+            for (uint32_t j = 1; j < block.size(); ++j)
+                maxDelta = std::max(maxDelta, block[j] - block[j - 1]);
+            uint32_t width = bitWidth(maxDelta);
+            bases.push_back(block[0]);
+            offsets.push_back(bitPos);
+            widths.push_back(width);
+            for (uint32_t j = 1; j < block.size() && width > 0; ++j, bitPos += width)
+            {
+                uint64_t delta = block[j] - block[j - 1];
+                if (deltas.size() <= (bitPos + width - 1) / 64)
+                    deltas.resize((bitPos + width - 1) / 64 + 1, 0);
+                deltas[bitPos / 64] |= delta << (bitPos % 64);
+                if (bitPos % 64 + width > 64)
+                    deltas[bitPos / 64 + 1] |= delta >> (64 - bitPos % 64);
+            }
+            count += block.size();
+            block.clear();
+        }
+        if (i < keys.size())
+            block.push_back(prefix);
+    }
+}
+
+RangeFilter::RangeFilter(const char *buf, uint64_t size) : count(0), size(size), budget(nullptr)
+{
+    memcpy(&shift, buf, 4);
+    memcpy(&count, buf + 8, 8);
+    uint64_t blocks = (count + BLOCK - 1) / BLOCK;
+    uint64_t directory = align8(13 * blocks);
+    // a filter this build cannot read is taken as none
+    if (shift >= NO_FILTER || 16 + directory > size)
+    {
+        shift = NO_FILTER;
+        count = 0;
+        return;
+    }
+    const char *pos = buf + 16;
+    bases.resize(blocks);
+    offsets.resize(blocks);
+    widths.resize(blocks);
+    if (blocks > 0)
+    {
+        memcpy(&bases[0], pos, 8 * blocks);
+        memcpy(&offsets[0], pos + 8 * blocks, 4 * blocks);
+        memcpy(&widths[0], pos + 12 * blocks, blocks);
+    }
+    deltas.resize((size - 16 - directory) / 8);
+    if (!deltas.empty())
+        memcpy(&deltas[0], pos + directory, 8 * deltas.size());
+}
+
+RangeFilter::~RangeFilter()
+{
+    if (budget)
+        budget->release(MEM_FILTER, byteSize());
+}
+
+void RangeFilter::charge(MemoryBudget *budget)
+{
+    if (this->budget || !budget)
+        return;
+    this->budget = budget;
+    budget->charge(MEM_FILTER, byteSize());
+}
+
+void RangeFilter::saveBuffer(char *buf) const
+{
+    memset(buf, 0, size);
+    memcpy(buf, &shift, 4);
+    memcpy(buf + 8, &count, 8);
+    uint64_t blocks = bases.size();
+    char *pos = buf + 16;
+    if (blocks > 0)
+    {
+        memcpy(pos, &bases[0], 8 * blocks);
+        memcpy(pos + 8 * blocks, &offsets[0], 4 * blocks);
+        memcpy(pos + 12 * blocks, &widths[0], blocks);
+    }
+    if (!deltas.empty())
+        memcpy(pos + align8(13 * blocks), &deltas[0], 8 * deltas.size());
+}
+
+uint64_t RangeFilter::readBits(uint64_t pos, uint32_t width) const
+{
+    uint64_t value = deltas[pos / 64] >> (pos % 64);
+    if (pos % 64 + width > 64)
+        value |= deltas[pos / 64 + 1] << (64 - pos % 64);
+    return width == 64 ? value : value & ((1ULL << width) - 1);
+}
+
+bool RangeFilter::mayContain(uint64_t key1, uint64_t key2) const
+{
+    if (shift == NO_FILTER || key1 > key2)
+        return true;
+    if (count == 0)
+        return false;
+    uint64_t lo = key1 >> shift, hi = key2 >> shift;
+    // the first prefix at or above lo decides, it sits in the last block
+    // starting at or below lo or begins the next one
+    uint64_t b = std::upper_bound(bases.begin(), bases.end(), lo) - bases.begin();
+    if (b == 0)
+        return bases[0] <= hi;
+    --b;
+    uint64_t n = std::min((uint64_t)BLOCK, count - b * BLOCK);
+    uint64_t prefix = bases[b], pos = offsets[b];
+    if (prefix >= lo)
+        return prefix <= hi;
+    for (uint64_t j = 1; j < n && widths[b] > 0; ++j, pos += widths[b])
+    {
+        prefix += readBits(pos, widths[b]);
+        if (prefix >= lo)
+            return prefix <= hi;
+    }
+    if (b + 1 < bases.size())
+        return bases[b + 1] <= hi;
+    return false;
+}
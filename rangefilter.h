@@ -0,0 +1,54 @@
+#pragma once
+
+#include "memorybudget.h"
+#include <cstdint>
+#include <vector>
+
+/**
+ * Answers whether a table may hold a key in [key1, key2] without its
+ * index. Like the trie of SuRF it keeps the keys cut down to their high
+ * bits: the distinct prefixes left after dropping the fewest low bits
+ * that fit in bitsPerKey, delta coded and bit packed in blocks of 64
+ * under a directory of block bases for binary search. A range is a maybe
+ * only if it shares a prefix with a key, so the filter is exact when
+ * nothing had to be dropped, and never has false negatives.
+ */
+class RangeFilter
+{
+private:
+	static const uint32_t BLOCK = 64;
+	// no cut fits the bits, every range is a maybe
+	static const uint32_t NO_FILTER = 64;
+
+	uint32_t shift;
+	uint64_t count;
+	// per block the first prefix, where its deltas start and their width
+	std::vector<uint64_t> bases;
+	std::vector<uint32_t> offsets;
+	std::vector<uint8_t> widths;
+	std::vector<uint64_t> deltas;
+	uint64_t size;
+	MemoryBudget *budget;
+
+	uint64_t readBits(uint64_t pos, uint32_t width) const;
+	static uint64_t packedSize(const std::vector<uint64_t> &keys, uint32_t shift);
+
+public:
+	// keys ascending, at most bitsPerKey per key all told
+	RangeFilter(const std::vector<uint64_t> &keys, uint32_t bitsPerKey);
+	// what saveBuffer wrote, size bytes of it
+	RangeFilter(const char *buf, uint64_t size);
+	~RangeFilter();
+
+	bool mayContain(uint64_t key1, uint64_t key2) const;
+
+	// the low bits dropped from every key, 64 when nothing fit
+	uint32_t getShift() const { return shift; }
+
+	uint64_t byteSize() const { return size; }
+	void saveBuffer(char *buf) const;
+	void charge(MemoryBudget *budget);
+
+	// byteSize() of the filter of num keys
+	static uint64_t byteSize(uint64_t num, uint32_t bitsPerKey);
+};
@@ -0,0 +1,100 @@
+#include "ratelimiter.h"
+#include <algorithm>
+
+const int64_t RateLimiter::REFILL_PERIOD;
+const uint32_t RateLimiter::TUNE_PERIODS;
+
+RateLimiter::RateLimiter(uint64_t bytesPerSecond, bool autoTune)
+    : maxRate(bytesPerSecond), rate(bytesPerSecond), autoTune(autoTune), available(0),
+      lastRefill(std::chrono::steady_clock::now()), highWaiting(0), drained(false),
+      periods(0), drainedPeriods(0)
+{
+    totalBytes[IO_LOW] = totalBytes[IO_HIGH] = 0;
+}
+
+uint64_t RateLimiter::burst() const
+{
+    return std::max<uint64_t>(rate * REFILL_PERIOD / 1000000, 1);
+}
+
+void RateLimiter::refill()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - lastRefill).count();
+    if (elapsed < REFILL_PERIOD)
+        return;
+    int64_t refills = elapsed / REFILL_PERIOD;
+    lastRefill += std::chrono::microseconds(refills * REFILL_PERIOD);
+    available = std::min(available + refills * burst(), burst());
+    periods += refills;
+    if (drained)
+        ++drainedPeriods;
+    drained = false;
+    if (autoTune && periods >= TUNE_PERIODS)
+    {
+        uint32_t percent = drainedPeriods * 100 / periods;
+        if (percent > 90)
+            rate = std::min(maxRate, rate + rate / 20 + 1);
+        else if (percent < 50)
+            rate = std::max(maxRate / 20, rate - rate / 20);
+        periods = drainedPeriods = 0;
+    }
+    cond.notify_all();
+}
+
+/**
+ * Blocks until the bytes may be read or written. Large requests are
+ * granted one bucket at a time.
+ */
+void RateLimiter::request(uint64_t bytes, IOPriority priority)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    totalBytes[priority] += bytes;
+    if (rate == 0)
+        return;
+    while (bytes > 0)
+    {
+        uint64_t chunk = 0;
+        if (priority == IO_HIGH)
+            ++highWaiting;
+        while (true)
+        {
+            refill();
+            // the rate may have been lowered while waiting, and the bucket with it
+            chunk = std::min(bytes, burst());
+            if (rate == 0 || (available >= chunk && (priority == IO_HIGH || highWaiting == 0)))
+                break;
+            if (available < chunk)
+                drained = true;
+            cond.wait_until(lock, lastRefill + std::chrono::microseconds(REFILL_PERIOD));
+        }
+        if (priority == IO_HIGH)
+            --highWaiting;
+        // limiting was switched off while waiting
+        if (rate == 0)
+            return;
+        available -= std::min(available, chunk);
+        bytes -= chunk;
+        cond.notify_all();
+    }
+}
+
+void RateLimiter::setBytesPerSecond(uint64_t bytesPerSecond)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    maxRate = rate = bytesPerSecond;
+    available = std::min(available, burst());
+    cond.notify_all();
+}
+
+uint64_t RateLimiter::getBytesPerSecond()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return rate;
+}
+
+uint64_t RateLimiter::getTotalBytes(IOPriority priority)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return totalBytes[priority];
+}
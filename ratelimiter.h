@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+enum IOPriority
+{
+	IO_LOW = 0,
+	IO_HIGH
+};
+
+/**
+ * Token bucket shared by flushes and compactions, possibly of several
+ * stores. Tokens are bytes, refilled every REFILL_PERIOD. High priority
+ * requests (flushes) are always served before low priority ones
+ * (compactions), so a long compaction never holds back a flush.
+ * With autoTune the rate moves between maxRate / 20 and maxRate: it goes
+ * up while requests keep draining the bucket, i.e. while compaction debt
+ * is piling up, and down while the bucket stays mostly unused.
+ * A rate of 0 disables limiting.
+ */
+class RateLimiter
+{
+private:
+	static const int64_t REFILL_PERIOD = 100000; // microseconds
+	static const uint32_t TUNE_PERIODS = 10;
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	uint64_t maxRate;
+	uint64_t rate;
+	bool autoTune;
+	uint64_t available;
+	std::chrono::steady_clock::time_point lastRefill;
+	uint32_t highWaiting;
+	bool drained;
+	uint32_t periods;
+	uint32_t drainedPeriods;
+	uint64_t totalBytes[2];
+
+	uint64_t burst() const;
+	void refill();
+
+public:
+	RateLimiter(uint64_t bytesPerSecond, bool autoTune = false);
+
+	void request(uint64_t bytes, IOPriority priority);
+
+	void setBytesPerSecond(uint64_t bytesPerSecond);
+
+	uint64_t getBytesPerSecond();
+
+	uint64_t getTotalBytes(IOPriority priority);
+};
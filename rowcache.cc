@@ -0,0 +1,77 @@
+#include "rowcache.h"
+
+const uint32_t RowCache::STRIPES;
+
+RowCache::RowCache(uint64_t capacity, MemoryBudget *budget) : ClockCache(capacity, budget)
+{
+    for (uint32_t i = 0; i < SHARDS; ++i)
+    {
+        for (uint32_t j = 0; j < STRIPES; ++j)
+            written[i][j] = 0;
+    }
+}
+
+void RowCache::insert(uint64_t key, const std::shared_ptr<const std::string> &value, uint64_t seq)
+{
+    uint64_t h = fmix64(key);
+    Shard &shard = shards[h % SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    // the key may have been written after the reader took its sequence
+    if (seq < written[h % SHARDS][h / SHARDS % STRIPES])
+        return;
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end())
+        evict(shard, it);
+    insertLocked(shard, key, value, value ? value->size() : 0);
+}
+
+void RowCache::erase(uint64_t key, uint64_t seq)
+{
+    uint64_t h = fmix64(key);
+    Shard &shard = shards[h % SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    uint64_t &stripe = written[h % SHARDS][h / SHARDS % STRIPES];
+    if (seq > stripe)
+        stripe = seq;
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end())
+        evict(shard, it);
+}
+
+void RowCache::eraseRange(uint64_t key1, uint64_t key2, uint64_t seq)
+{
+    for (uint32_t i = 0; i < SHARDS; ++i)
+    {
+        Shard &shard = shards[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (uint32_t j = 0; j < STRIPES; ++j)
+            if (seq > written[i][j])
+                written[i][j] = seq;
+        // hashed keys have no order, a short range is looked up key by key
+        if (key2 - key1 < shard.entries.size())
+        {
+            for (uint64_t key = key1;; ++key)
+            {
+                auto it = shard.entries.find(key);
+                if (it != shard.entries.end())
+                    evict(shard, it);
+                if (key == key2)
+                    break;
+            }
+            continue;
+        }
+        for (auto it = shard.entries.begin(); it != shard.entries.end();)
+        {
+            auto next = it;
+            ++next;
+            if (it->first >= key1 && it->first <= key2)
+                evict(shard, it);
+            it = next;
+        }
+    }
+}
+
+void RowCache::clear(uint64_t seq)
+{
+    eraseRange(0, UINT64_MAX, seq);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "clockcache.h"
+#include <string>
+#include <memory>
+
+/**
+ * Resolved values of recently read keys, a null value records that the
+ * key was not found. Entries are filled by get at the sequence it read
+ * at and dropped by every write to their key; a fill older than a write
+ * already seen for its key is refused, so a reader racing a writer never
+ * leaves a stale value behind. Sharding and CLOCK eviction come from
+ * ClockCache.
+ */
+class RowCache : public ClockCache<std::shared_ptr<const std::string>>
+{
+private:
+	static const uint32_t STRIPES = 4;
+
+	// the newest write seen by the keys of each stripe of each shard, under the shard's lock
+	uint64_t written[SHARDS][STRIPES];
+
+public:
+	RowCache(uint64_t capacity, MemoryBudget *budget = nullptr);
+
+	// true on a hit, with a null value for a key known not to exist
+	using ClockCache::lookup;
+
+	// value as read at seq, null if the key was not found
+	void insert(uint64_t key, const std::shared_ptr<const std::string> &value, uint64_t seq);
+
+	// a write at seq to the key or the keys in [key1, key2]
+	void erase(uint64_t key, uint64_t seq);
+	void eraseRange(uint64_t key1, uint64_t key2, uint64_t seq);
+	void clear(uint64_t seq);
+};
@@ -0,0 +1,109 @@
+#include "shardedkvstore.h"
+#include "utils.h"
+#include "MurmurHash3.h"
+#include <fstream>
+
+ShardedKVStore::ShardedKVStore(const std::string &dir, uint32_t shardNum, ShardPartition partition,
+							   const CompactionOptions &options)
+	: KVStoreAPI(dir), partition(partition)
+{
+	if (shardNum == 0)
+		shardNum = 1;
+	utils::mkdir(dir.c_str());
+	// the layout is fixed once data exists, otherwise keys would be routed elsewhere
+	std::string layoutPath = dir + "/SHARDS";
+	std::ifstream layoutIn(layoutPath);
+	if (layoutIn)
+	{
+		uint32_t oldNum, oldPartition;
+		layoutIn >> oldNum >> oldPartition;
+		if (oldNum != shardNum || oldPartition != (uint32_t)partition)
+		{
+			printf("Shard layout mismatch in %s: %u shards, partition %u", dir.c_str(), oldNum, oldPartition);
+			exit(-1);
+		}
+	}
+	else
+	{
+		std::ofstream layoutOut(layoutPath);
+		layoutOut << shardNum << " " << (uint32_t)partition << std::endl;
+	}
+	rangeWidth = shardNum == 1 ? 0 : UINT64_MAX / shardNum + 1;
+	for (uint32_t i = 0; i < shardNum; ++i)
+		shards.push_back(std::unique_ptr<KVStore>(new KVStore(dir + "/shard-" + std::to_string(i), options)));
+}
+
+uint32_t ShardedKVStore::shardOf(uint64_t key) const
+{
+	if (shards.size() == 1)
+		return 0;
+	if (partition == RANGE_PARTITION)
+		return key / rangeWidth;
+	// finalizer of MurmurHash3, spreads sequential keys over all shards
+	return fmix64(key) % shards.size();
+}
+
+void ShardedKVStore::put(uint64_t key, const std::string &s)
+{
+	shards[shardOf(key)]->put(key, s);
+}
+
+std::string ShardedKVStore::get(uint64_t key)
+{
+	return shards[shardOf(key)]->get(key);
+}
+
+bool ShardedKVStore::getPinned(uint64_t key, PinnableSlice *value)
+{
+	return shards[shardOf(key)]->getPinned(key, value);
+}
+
+bool ShardedKVStore::del(uint64_t key)
+{
+	return shards[shardOf(key)]->del(key);
+}
+
+void ShardedKVStore::deleteRange(uint64_t key1, uint64_t key2)
+{
+	if (key1 > key2)
+		return;
+	if (partition == RANGE_PARTITION)
+	{
+		for (uint32_t i = shardOf(key1); i <= shardOf(key2); ++i)
+			shards[i]->deleteRange(key1, key2);
+	}
+	else
+	{
+		for (auto it = shards.begin(); it != shards.end(); ++it)
+			(*it)->deleteRange(key1, key2);
+	}
+}
+
+void ShardedKVStore::reset()
+{
+	for (auto it = shards.begin(); it != shards.end(); ++it)
+		(*it)->reset();
+}
+
+void ShardedKVStore::scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list)
+{
+	if (key1 > key2)
+		return;
+	if (partition == RANGE_PARTITION)
+	{
+		// shards hold consecutive key ranges, so their results just line up
+		for (uint32_t i = shardOf(key1); i <= shardOf(key2); ++i)
+			shards[i]->scan(key1, key2, list);
+		return;
+	}
+	std::list<std::pair<uint64_t, std::string>> result;
+	for (auto it = shards.begin(); it != shards.end(); ++it)
+	{
+		std::list<std::pair<uint64_t, std::string>> part;
+		(*it)->scan(key1, key2, part);
+		result.merge(part, [](const std::pair<uint64_t, std::string> &a, const std::pair<uint64_t, std::string> &b) {
+			return a.first < b.first;
+		});
+	}
+	list.splice(list.end(), result);
+}
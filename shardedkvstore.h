@@ -0,0 +1,44 @@
+#pragma once
+
+#include "kvstore.h"
+#include <memory>
+#include <vector>
+
+enum ShardPartition
+{
+	HASH_PARTITION = 1,
+	RANGE_PARTITION
+};
+
+/**
+ * Splits the key space across several independent KVStores, each living
+ * in its own sub-directory with its own memtable, levels and compaction.
+ * Point operations touch exactly one shard, scans merge across shards.
+ */
+class ShardedKVStore : public KVStoreAPI
+{
+private:
+	std::vector<std::unique_ptr<KVStore>> shards;
+	ShardPartition partition;
+	uint64_t rangeWidth;
+
+	uint32_t shardOf(uint64_t key) const;
+
+public:
+	ShardedKVStore(const std::string &dir, uint32_t shardNum = 4, ShardPartition partition = HASH_PARTITION,
+				   const CompactionOptions &options = CompactionOptions());
+
+	void put(uint64_t key, const std::string &s) override;
+
+	std::string get(uint64_t key) override;
+
+	bool getPinned(uint64_t key, PinnableSlice *value);
+
+	bool del(uint64_t key) override;
+
+	void deleteRange(uint64_t key1, uint64_t key2) override;
+
+	void reset() override;
+
+	void scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list) override;
+};
@@ -1,181 +1,189 @@
-#include "skiplist.h"
-#include <cstring>
-
-double SkipList::my_rand()
-{
-    s = (16807 * s) % 2147483647ULL;
-    return (s + 0.0) / 2147483647ULL;
-}
-
-int SkipList::randomLevel()
-{
-    int result = 1;
-    while (result < MAX_LEVEL && my_rand() < 0.5)
-    {
-        ++result;
-    }
-    return result;
-}
-
-void SkipList::Insert(uint64_t key, std::string value)
-{
-    SKNode *update[MAX_LEVEL];
-    SKNode *NewNode;
-    for (int i = 0; i < MAX_LEVEL; ++i)
-    {
-        update[i] = head;
-    }
-    SKNode *x = head;
-    int num = MAX_LEVEL;
-    for (int i = num - 1; i >= 0; --i)
-    {
-        while (x->forwards[i]->type != 3 && x->forwards[i]->key <= key)
-        {
-            x = x->forwards[i];
-        }
-        update[i] = x;
-    }
-    x = update[0];
-    if (x->type == NORMAL && x->key == key)
-    {
-        cacheSize = cacheSize - x->val.size() + value.size();
-        x->val = value;
-        return;
-    }
-    else
-    {
-        int lvl = randomLevel();
-        NewNode = new SKNode(key, value, NORMAL);
-        for (int i = 0; i < lvl; ++i)
-        {
-            NewNode->forwards[i] = update[i]->forwards[i];
-            update[i]->forwards[i] = NewNode;
-        }
-        cacheSize += 12 + value.size();
-        ++length;
-    }
-}
-
-std::string SkipList::Search(uint64_t key)
-{
-    SKNode *x = head;
-    hot = NULL;
-    int num = MAX_LEVEL;
-    for (int i = num - 1; i >= 0; --i)
-    {
-        if (x->forwards[i]->type == 3)
-        {
-            if (i > 0)
-                continue;
-        }
-        while (x->forwards[i]->type == NORMAL && x->forwards[i]->key < key)
-        {
-            x = x->forwards[i];
-        }
-    }
-    if ((x->forwards[0]->type == NORMAL) && (x->forwards[0]->key == key))
-    {
-        hot = x->forwards[0];
-        return hot->val;
-    }
-    else
-        return "";
-}
-
-
-bool SkipList::scanSearch(uint64_t key_start, uint64_t key_end, std::list<std::pair<uint64_t, std::string>> &list)
-{
-    SKNode *x = head;
-    int num = MAX_LEVEL;
-    for (int i = num - 1; i >= 0; --i)
-    {
-        if (x->forwards[i]->type == 3)
-            continue;
-        while (x->forwards[i]->type == NORMAL && x->forwards[i]->key < key_start)
-        {
-            x = x->forwards[i];
-        }
-    }
-    if ((x->forwards[0]->type == NORMAL) && (x->forwards[0]->key >= key_start) && (x->forwards[0]->key <= key_end))
-    {
-        do
-        {
-            std::pair<uint64_t, std::string> temp(x->forwards[0]->key, x->forwards[0]->val);
-            list.push_back(temp);
-            x = x->forwards[0];
-        } while (x->forwards[0]->type == NORMAL && x->forwards[0]->key <= key_end);
-    }
-    if (list.empty())
-        return false;
-    return true;
-}
-
-SSTableCache *SkipList::transform(const std::string &dir, const uint64_t &currentTime)
-{
-    SSTableCache *cache = new SSTableCache();
-    char *buffer = new char[cacheSize];
-    cache->Header.timestamp = currentTime;
-    cache->Header.num = length;
-    *(uint64_t *)buffer = currentTime;
-    SKNode *x = head;
-    x = x->forwards[0];
-    *(uint64_t *)(buffer + 8) = length;
-    *(uint64_t *)(buffer + 16) = x->key;
-    char *index = buffer + 10272;
-    uint64_t offerset = 10272 + 12 * length;
-    while (x != NIL)
-    {
-        uint64_t key = x->key;
-        cache->BF->setBF(key);
-        INDEX temp;
-        temp.Key = key;
-        temp.Offset = offerset;
-        *(uint64_t *)index = key;
-        index += 8;
-        *(uint32_t *)index = offerset;
-        index += 4;
-        cache->Index.push_back(temp);
-        uint32_t strlen = x->val.size();
-        if(strlen + offerset > cacheSize)
-        {
-            cout<<"buffer flow !"<<endl;
-            exit(-1);
-        }
-        memcpy(buffer + offerset, (x->val).c_str(), strlen);
-        offerset += strlen;
-        x = x->forwards[0];
-    }
-
-    cache->Header.max = cache->Index[cache->Header.num - 1].Key;
-    *(uint64_t *)(buffer + 24) = cache->Header.max;
-    cache->Header.min = cache->Index[0].Key;
-    std::string fileName = dir + "/" + std::to_string(currentTime) + ".sst";
-    cache->path = fileName;
-
-    cache->BF->saveBuffer(buffer + 32);
-    std::ofstream outFile(fileName, std::ios::binary | std::ios::out);
-    outFile.write(buffer, cacheSize);
-    delete[] buffer;
-    outFile.close();
-    return cache;
-}
-
-bool SkipList::needTransform(uint64_t key, std::string value)
-{
-    string s = Search(key);
-    int size = cacheSize;
-    if (s == "")
-    {
-        size += 12 + value.size();
-    }
-    else
-    {
-        size = size - hot->val.size() + value.size();
-    }
-    if (size > MAX_TABLE_SIZE)
-        return true;
-    else
-        return false;
-}
-
-
+#include "skiplist.h"
+#include "tablebuilder.h"
+#include "MurmurHash3.h"
+#include <cstring>
+
+double SkipList::my_rand()
+{
+    s = (16807 * s) % 2147483647ULL;
+    return (s + 0.0) / 2147483647ULL;
+}
+
+int SkipList::randomLevel()
+{
+    int result = 1;
+    while (result < MAX_LEVEL && my_rand() < 0.5)
+    {
+        ++result;
+    }
+    return result;
+}
+
+static uint32_t hashKey(uint64_t key, uint32_t bucketCount)
+{
+    // the finalizer of MurmurHash3, sequential keys spread over all buckets
+    return fmix64(key) % bucketCount;
+}
+
+HashEntry *SkipList::findEntry(uint64_t key)
+{
+    HashEntry *e = buckets[hashKey(key, bucketCount)].load(std::memory_order_acquire);
+    while (e && e->key != key)
+        e = e->chain;
+    return e;
+}
+
+void SkipList::Insert(uint64_t key, uint64_t seq, std::string value)
+{
+    SKNode *update[MAX_LEVEL];
+    SKNode *NewNode;
+    for (int i = 0; i < MAX_LEVEL; ++i)
+    {
+        update[i] = head;
+    }
+    SKNode *x = head;
+    int num = MAX_LEVEL;
+    // nodes are ordered by key, then by sequence number from newest to oldest
+    for (int i = num - 1; i >= 0; --i)
+    {
+        SKNode *next = x->next(i);
+        while (next->type == NORMAL && (next->key < key || (next->key == key && next->seq > seq)))
+        {
+            x = next;
+            next = x->next(i);
+        }
+        update[i] = x;
+    }
+    int lvl = randomLevel();
+    NewNode = new SKNode(key, value, NORMAL, seq);
+    for (int i = 0; i < lvl; ++i)
+    {
+        NewNode->setNext(i, update[i]->next(i));
+        update[i]->setNext(i, NewNode);
+    }
+    cacheSize += 12 + value.size();
+    ++length;
+    uint64_t bytes = sizeof(SKNode) + value.size();
+    if (buckets)
+    {
+        // published after the node is linked, a reader finding it can walk on
+        HashEntry *e = findEntry(key);
+        if (!e)
+        {
+            std::atomic<HashEntry *> &bucket = buckets[hashKey(key, bucketCount)];
+            bucket.store(new HashEntry(key, NewNode, bucket.load(std::memory_order_relaxed)), std::memory_order_release);
+            bytes += sizeof(HashEntry);
+        }
+        else if (e->newest.load(std::memory_order_relaxed)->seq < seq)
+            e->newest.store(NewNode, std::memory_order_release);
+    }
+    arenaBytes += bytes;
+    if (budget)
+        budget->charge(MEM_MEMTABLE, bytes);
+}
+
+SKNode *SkipList::Search(uint64_t key, uint64_t seq)
+{
+    if (buckets)
+    {
+        // older versions follow the newest one on the bottom level
+        HashEntry *e = findEntry(key);
+        if (!e)
+            return nullptr;
+        SKNode *x = e->newest.load(std::memory_order_acquire);
+        while (x->type == NORMAL && x->key == key && x->seq > seq)
+            x = x->next(0);
+        if (x->type == NORMAL && x->key == key)
+            return x;
+        return nullptr;
+    }
+    SKNode *x = head;
+    int num = MAX_LEVEL;
+    for (int i = num - 1; i >= 0; --i)
+    {
+        SKNode *next = x->next(i);
+        while (next->type == NORMAL && (next->key < key || (next->key == key && next->seq > seq)))
+        {
+            x = next;
+            next = x->next(i);
+        }
+    }
+    x = x->next(0);
+    if ((x->type == NORMAL) && (x->key == key))
+        return x;
+    else
+        return nullptr;
+}
+
+
+bool SkipList::scanSearch(uint64_t key_start, uint64_t key_end, uint64_t seq, std::list<ENTRY> &list)
+{
+    SKNode *x = head;
+    int num = MAX_LEVEL;
+    for (int i = num - 1; i >= 0; --i)
+    {
+        SKNode *next = x->next(i);
+        while (next->type == NORMAL && next->key < key_start)
+        {
+            x = next;
+            next = x->next(i);
+        }
+    }
+    x = x->next(0);
+    while (x->type == NORMAL && x->key <= key_end)
+    {
+        // only the newest version visible at seq is reported
+        if (x->seq <= seq && (list.empty() || list.back().key != x->key))
+            list.push_back(ENTRY(x->key, x->seq, x->val));
+        x = x->next(0);
+    }
+    if (list.empty())
+        return false;
+    return true;
+}
+
+void SkipList::addRangeDel(uint64_t key_start, uint64_t key_end, uint64_t seq)
+{
+    // copy on write, readers keep whatever list they already loaded
+    std::shared_ptr<std::vector<range>> rangeDel = std::make_shared<std::vector<range>>(*RangeDel);
+    rangeDel->push_back(range(key_start, key_end, seq));
+    std::atomic_store(&RangeDel, std::shared_ptr<const std::vector<range>>(rangeDel));
+}
+
+SSTableCache *SkipList::transform(const std::string &dir, const uint64_t &currentTime, const std::multiset<uint64_t> &snapshots, const TableWriteOptions &options)
+{
+    // drop the versions no reader can see any more before sizing the table
+    std::vector<SKNode *> nodes;
+    uint64_t newerSeq = UINT64_MAX;
+    uint64_t tableSize = 10272 + FOOTER_SIZE;
+    for (SKNode *x = head->next(0); x != NIL; x = x->next(0))
+    {
+        if (nodes.empty() || nodes.back()->key != x->key)
+            newerSeq = UINT64_MAX;
+        uint64_t hideSeq = min(newerSeq, hiddenSeq(*RangeDel, x->key, x->seq));
+        newerSeq = x->seq;
+        if (needVersion(x->seq, hideSeq, snapshots))
+        {
+            nodes.push_back(x);
+            tableSize += 12 + x->val.size();
+        }
+    }
+    uint32_t num = nodes.size();
+    tableSize += metaSize(*RangeDel, num, options);
+
+    std::string fileName = dir + "/" + std::to_string(currentTime) + ".sst";
+    // flushes go ahead of compactions so the memtable never waits on them
+    TableBuilder builder(fileName, num, tableSize, IO_HIGH, options);
+    for (auto it = nodes.begin(); it != nodes.end(); ++it)
+        builder.add((*it)->key, (*it)->seq, (*it)->val);
+    return builder.finish(currentTime, *RangeDel);
+}
+
+bool SkipList::needTransform(std::string value, const TableWriteOptions &options)
+{
+    uint64_t size = cacheSize + 12 + value.size() + metaSize(*RangeDel, length + 1, options);
+    if (size > MAX_TABLE_SIZE)
+        return true;
+    else
+        return false;
+}
@@ -1,79 +1,128 @@
-#ifndef SKIPLIST_H
-#define SKIPLIST_H
-
-#include <iostream>
-#include <vector>
-#include <climits>
-#include "sstable.h"
-#include <list>
-#include <fstream>
-
-#define MAX_LEVEL 8
-
-enum SKNodeType
-{
-    HEAD = 1,
-    NORMAL,
-    NIL
-};
-
-struct SKNode
-{
-    uint64_t key;
-    std::string val;
-    SKNodeType type;
-    std::vector<SKNode *> forwards;
-    SKNode(uint64_t _key, std::string _val, SKNodeType _type)
-        : key(_key), val(_val), type(_type)
-    {
-        for (int i = 0; i < MAX_LEVEL; ++i)
-        {
-            forwards.push_back(nullptr);
-        }
-    }
-};
-
-class SkipList
-{
-private:
-    SKNode *head;
-    SKNode *NIL;
-
-    uint64_t s = 1;
-    double my_rand();
-    int randomLevel();
-
-public:
-    uint64_t cacheSize;
-    uint32_t length;
-    SkipList()
-    {
-        head = new SKNode(0, "", SKNodeType::HEAD);
-        NIL = new SKNode(INT_MAX, "", SKNodeType::NIL);
-        cacheSize = 10272;
-        length = 0;
-        for (int i = 0; i < MAX_LEVEL; ++i)
-        {
-            head->forwards[i] = NIL;
-        }
-    }
-    SKNode *hot;
-    void Insert(uint64_t key, std::string value);
-    std::string Search(uint64_t key);
-    bool scanSearch(uint64_t key_start, uint64_t key_end, std::list<std::pair<uint64_t, std::string>> &list);
-    SSTableCache *transform(const std::string &dir, const uint64_t &currentTime);
-    bool needTransform(uint64_t key, string value);
-    ~SkipList()
-    {
-        SKNode *n1 = head;
-        SKNode *n2;
-        while (n1)
-        {
-            n2 = n1->forwards[0];
-            delete n1;
-            n1 = n2;
-        }
-    }
-};
-
-#endif // SKIPLIST_H
+#ifndef SKIPLIST_H
+#define SKIPLIST_H
+
+#include <iostream>
+#include <vector>
+#include <climits>
+#include "sstable.h"
+#include <list>
+#include <fstream>
+#include <atomic>
+#include <memory>
+
+#define MAX_LEVEL 8
+
+enum SKNodeType
+{
+    HEAD = 1,
+    NORMAL,
+    NIL
+};
+
+struct SKNode
+{
+    uint64_t key;
+    uint64_t seq;
+    std::string val;
+    SKNodeType type;
+    std::atomic<SKNode *> forwards[MAX_LEVEL];
+    SKNode(uint64_t _key, std::string _val, SKNodeType _type, uint64_t _seq = 0)
+        : key(_key), seq(_seq), val(_val), type(_type)
+    {
+        for (int i = 0; i < MAX_LEVEL; ++i)
+        {
+            forwards[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+    // readers walk the list while the writer links new nodes in
+    SKNode *next(int i) { return forwards[i].load(std::memory_order_acquire); }
+    void setNext(int i, SKNode *x) { forwards[i].store(x, std::memory_order_release); }
+};
+
+// the newest version of one key, reachable from its hash bucket
+struct HashEntry
+{
+    uint64_t key;
+    std::atomic<SKNode *> newest;
+    HashEntry *chain;
+    HashEntry(uint64_t _key, SKNode *node, HashEntry *_chain) : key(_key), newest(node), chain(_chain) {}
+};
+
+class SkipList
+{
+private:
+    SKNode *head;
+    SKNode *NIL;
+
+    uint64_t s = 1;
+    MemoryBudget *budget;
+    // optional hash index next to the list, key to its newest node, so
+    // point lookups skip the descent; entries are only ever added
+    std::atomic<HashEntry *> *buckets;
+    uint32_t bucketCount;
+    double my_rand();
+    int randomLevel();
+    HashEntry *findEntry(uint64_t key);
+
+public:
+    uint64_t cacheSize;
+    uint32_t length;
+    // nodes and values held in memory, charged to the budget until freed
+    uint64_t arenaBytes;
+    std::shared_ptr<const std::vector<range>> RangeDel;
+    SkipList(MemoryBudget *budget = nullptr, uint32_t hashBuckets = 0) : budget(budget), buckets(nullptr), bucketCount(hashBuckets)
+    {
+        RangeDel = std::make_shared<const std::vector<range>>();
+        head = new SKNode(0, "", SKNodeType::HEAD);
+        NIL = new SKNode(INT_MAX, "", SKNodeType::NIL);
+        cacheSize = 10272 + FOOTER_SIZE;
+        length = 0;
+        arenaBytes = 0;
+        for (int i = 0; i < MAX_LEVEL; ++i)
+        {
+            head->setNext(i, NIL);
+        }
+        if (bucketCount > 0)
+        {
+            buckets = new std::atomic<HashEntry *>[bucketCount];
+            for (uint32_t i = 0; i < bucketCount; ++i)
+                buckets[i].store(nullptr, std::memory_order_relaxed);
+            if (budget)
+                budget->charge(MEM_MEMTABLE, sizeof(std::atomic<HashEntry *>) * bucketCount);
+        }
+    }
+    void Insert(uint64_t key, uint64_t seq, std::string value);
+    SKNode *Search(uint64_t key, uint64_t seq);
+    bool hashed() const { return buckets != nullptr; }
+    bool scanSearch(uint64_t key_start, uint64_t key_end, uint64_t seq, std::list<ENTRY> &list);
+    void addRangeDel(uint64_t key_start, uint64_t key_end, uint64_t seq);
+    std::shared_ptr<const std::vector<range>> getRangeDel() { return std::atomic_load(&RangeDel); }
+    SSTableCache *transform(const std::string &dir, const uint64_t &currentTime, const std::multiset<uint64_t> &snapshots, const TableWriteOptions &options = TableWriteOptions());
+    bool needTransform(string value, const TableWriteOptions &options = TableWriteOptions());
+    ~SkipList()
+    {
+        if (budget)
+            budget->release(MEM_MEMTABLE, arenaBytes + sizeof(std::atomic<HashEntry *>) * bucketCount);
+        SKNode *n1 = head;
+        SKNode *n2;
+        while (n1)
+        {
+            n2 = n1->next(0);
+            delete n1;
+            n1 = n2;
+        }
+        for (uint32_t i = 0; i < bucketCount; ++i)
+        {
+            HashEntry *e = buckets[i].load(std::memory_order_relaxed);
+            while (e)
+            {
+                HashEntry *chain = e->chain;
+                delete e;
+                e = chain;
+            }
+        }
+        delete[] buckets;
+    }
+};
+
+#endif // SKIPLIST_H
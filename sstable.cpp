@@ -1,300 +1,1187 @@
-#include "sstable.h"
-
-SSTableCache::SSTableCache()
-{
-    BF = new BloomFilter();
-}
-
-SSTableCache::SSTableCache(const std::string &dir)
-{
-    path = dir;
-    std::ifstream file(dir, std::ios::binary);
-    if (!file)
-    {
-        printf("Fail to open file %s", dir.c_str());
-        exit(-1);
-    }
-    file.read((char *)&Header.timestamp, 8);
-    file.read((char *)&Header.num, 8);
-    file.read((char *)&Header.min, 8);
-    file.read((char *)&Header.max, 8);
-    char *filterBuf = new char[10240];
-    file.read(filterBuf, 10240);
-    BF = new BloomFilter(filterBuf);
-    uint64_t length = Header.num;
-    char *indexBuf = new char[length * 12];
-    file.read(indexBuf, length * 12);
-    for (unsigned i = 0; i < length; ++i)
-    {
-        Index.push_back(INDEX(*(uint64_t *)(indexBuf + 12 * i), *(uint64_t *)(indexBuf + 12 * i + 8)));
-        ;
-    }
-    delete[] filterBuf;
-    delete[] indexBuf;
-    file.close();
-}
-
-int SSTableCache::search(uint64_t key)
-{
-    if (key <= Header.max && key >= Header.min && BF->isExisted(key))
-    {
-        return find(key, 0, Index.size() - 1);
-    }
-    else
-        return -1;
-}
-
-int SSTableCache::find(uint64_t key, int lo, int hi)
-{
-    if (lo > hi)
-        return -1;
-    if (lo == hi)
-    {
-        if (Index[lo].Key == key)
-            return lo;
-        else
-            return -1;
-    }
-    int mi = (hi + lo) >> 1;
-    if (Index[mi].Key == key)
-        return mi;
-    else if (Index[mi].Key < key)
-        return find(key, mi + 1, hi);
-    else
-        return find(key, lo, mi - 1);
-}
-
-int SSTableCache::lowpos(uint64_t key1, uint64_t key2)
-{
-    if (key1 > (Header).max || key2 < (Header).min)
-        return -1;
-    uint64_t lo, hi;
-    lo = max((Header).min, key1);
-    hi = min((Header).max, key2);
-    int Lowpos = find2(0, Header.num - 1, lo, hi);
-    if (Lowpos == -1)
-        return -1;
-    while (Lowpos != 0)
-    {
-        if (Index[Lowpos - 1].Key >= key1 && Index[Lowpos - 1].Key <= key2)
-            Lowpos--;
-        else
-            break;
-    }
-    return Lowpos;
-}
-
-int SSTableCache::find2(int lo, int hi, uint64_t key1, uint64_t key2)
-{
-    if (lo == hi)
-    {
-        if (Index[lo].Key >= key1 && Index[lo].Key <= key2)
-            return lo;
-        else
-            return -1;
-    }
-    int mi = (hi + lo) >> 1;
-    if (Index[mi].Key >= key1 && Index[mi].Key <= key2)
-        return mi;
-    else if (Index[mi].Key > key2)
-        return find2(lo, mi - 1, key1, key2);
-    else
-        return find2(mi + 1, hi, key1, key2);
-}
-
-SSTable::SSTable(SSTableCache *cache)
-{
-    path = cache->path;
-    std::ifstream file(path, std::ios::binary);
-    if (!file)
-    {
-        printf("Fail to open file %s", path.c_str());
-        exit(-1);
-    }
-    timeStamp = cache->Header.timestamp;
-    length = (cache->Header).num;
-    file.seekg((cache->Index)[0].Offset);
-    for (auto it = (cache->Index).begin();;)
-    {
-        uint64_t key = (*it).Key;
-        uint32_t offset = (*it).Offset;
-        std::string val;
-        if (++it == (cache->Index).end())
-        {
-            file >> val;
-            Entries.push_back(std::pair<uint64_t, std::string>(key, val));
-            break;
-        }
-        else
-        {
-            uint32_t length = (*it).Offset - offset;
-            char *buf = new char[length + 1];
-            buf[length] = '\0';
-            file.read(buf, length);
-            val = buf;
-            delete[] buf;
-            Entries.push_back(std::pair<uint64_t, std::string>(key, val));
-        }
-    }
-    delete cache;
-}
-
-void SSTable::merge(std::vector<SSTable> &tables)
-{
-    uint64_t size = tables.size();
-    if (size == 1)
-        return;
-    uint32_t group = size / 2;
-    std::vector<SSTable> next;
-    for (uint32_t i = 0; i < group; ++i)
-    {
-        next.push_back(merge2(tables[2 * i], tables[2 * i + 1]));
-    }
-    if (size % 2 == 1)
-        next.push_back(tables[size - 1]);
-    merge(next);
-    tables = next;
-}
-
-std::vector<SSTableCache *> SSTable::save(const std::string &dir)
-{
-    std::vector<SSTableCache *> caches;
-    SSTable newTable;
-    uint64_t num = 0;
-    while (!Entries.empty())
-    {
-        if (newTable.size + 12 + Entries.front().second.size() >= MAX_TABLE_SIZE)
-        {
-            caches.push_back(newTable.saveSingle(dir, timeStamp, num++));
-            newTable = SSTable();
-        }
-        newTable.add(Entries.front());
-        Entries.pop_front();
-    }
-    if (newTable.length > 0)
-    {
-        caches.push_back(newTable.saveSingle(dir, timeStamp, num));
-    }
-    return caches;
-}
-
-SSTable SSTable::merge2(SSTable &a, SSTable &b)
-{
-    SSTable result;
-    result.timeStamp = a.timeStamp;
-    while ((!a.Entries.empty()) && (!b.Entries.empty()))
-    {
-        uint64_t aKey = a.Entries.front().first, bKey = b.Entries.front().first;
-        if (aKey > bKey)
-        {
-            result.Entries.push_back(b.Entries.front());
-            b.Entries.pop_front();
-        }
-        else if (aKey < bKey)
-        {
-            result.Entries.push_back(a.Entries.front());
-            a.Entries.pop_front();
-        }
-        else
-        {
-            result.Entries.push_back(a.Entries.front());
-            a.Entries.pop_front();
-            b.Entries.pop_front();
-        }
-    }
-    while (!a.Entries.empty())
-    {
-        result.Entries.push_back(a.Entries.front());
-        a.Entries.pop_front();
-    }
-    while (!b.Entries.empty())
-    {
-        result.Entries.push_back(b.Entries.front());
-        b.Entries.pop_front();
-    }
-    return result;
-}
-
-bool cacheTimeCompare(SSTableCache *a, SSTableCache *b)
-{
-    return (a->Header).timestamp > (b->Header).timestamp;
-}
-
-bool haveIntersection(const SSTableCache *cache, const std::vector<range> &ranges)
-{
-    unsigned long long min = (cache->Header).min;
-    unsigned long long max = (cache->Header).max;
-    for (auto it = ranges.begin(); it != ranges.end(); ++it)
-    {
-        if (!((*it).max < min || (*it).min > max))
-        {
-            return true;
-        }
-    }
-    return false;
-}
-
-bool tableTimecompare(SSTable &a, SSTable &b)
-{
-    return a.timeStamp > b.timeStamp;
-}
-
-void SSTable::add(std::pair<uint64_t, std::string> &entry)
-{
-    size += 12 + entry.second.size();
-    length++;
-    Entries.push_back(entry);
-}
-
-SSTableCache *SSTable::saveSingle(const std::string &dir, const uint64_t &currentTime, const uint64_t &num)
-{
-    SSTableCache *cache = new SSTableCache;
-
-    char *buffer = new char[size];
-    BloomFilter *filter = cache->BF;
-
-    *(uint64_t *)buffer = currentTime;
-    (cache->Header).timestamp = currentTime;
-
-    *(uint64_t *)(buffer + 8) = length;
-    (cache->Header).num = length;
-
-    *(uint64_t *)(buffer + 16) = Entries.front().first;
-    (cache->Header).min = Entries.front().first;
-
-    char *index = buffer + 10272;
-    uint32_t offset = 10272 + length * 12;
-
-    for (auto it = Entries.begin(); it != Entries.end(); ++it)
-    {
-        filter->setBF((*it).first);
-        *(uint64_t *)index = (*it).first;
-        index += 8;
-        *(uint32_t *)index = offset;
-        index += 4;
-
-        (cache->Index).push_back(INDEX((*it).first, offset));
-        uint32_t strLen = ((*it).second).size();
-        uint32_t newOffset = offset + strLen;
-        if (newOffset > size)
-        {
-            printf("Buffer Overflow!!!\n");
-            exit(-1);
-        }
-        memcpy(buffer + offset, ((*it).second).c_str(), strLen);
-        offset = newOffset;
-    }
-
-    *(uint64_t *)(buffer + 24) = Entries.back().first;
-    (cache->Header).max = Entries.back().first;
-    filter->saveBuffer(buffer + 32);
-
-    std::string filename = dir + "/" + std::to_string(currentTime) + "-" + std::to_string(num) + ".sst";
-    cache->path = filename;
-    std::ofstream outFile(filename, std::ios::binary | std::ios::out);
-    outFile.write(buffer, size);
-
-    delete[] buffer;
-    outFile.close();
-    return cache;
-}
+#include "sstable.h"
+#include "utils.h"
+#include "tablebuilder.h"
+#include "crc32c.h"
+#include <algorithm>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// a checksum block starts with its own checksum, the head's, and the count of blocks before it
+static const uint64_t CHECKSUM_HEADER = 16;
+// the blocks a table may have ahead of its checksum block
+static const uint64_t MAX_META_BLOCKS = 7;
+// what verify() asks the rate limiter for at once
+static const uint64_t VERIFY_PIECE = 256 * 1024;
+
+static void corrupt(const std::string &path)
+{
+    printf("Corrupt table %s\n", path.c_str());
+    exit(-1);
+}
+
+/**
+ * Check the meta blocks of a table, size bytes read from metaOffset up
+ * to the footer, against the checksum block that ends them. checksum is
+ * set to where that block's payload starts, or to size for a table
+ * written without one. False if a block does not match its checksum or
+ * the blocks overrun the region.
+ */
+static bool checkMeta(const char *meta, uint64_t size, uint64_t &checksum)
+{
+    checksum = size;
+    vector<uint64_t> starts;
+    uint64_t pos = 0;
+    while (pos + 8 <= size)
+    {
+        uint32_t blockSize = *(const uint32_t *)(meta + pos + 4);
+        if (blockSize > size - pos - 8)
+            return false;
+        starts.push_back(pos);
+        pos += 8 + blockSize;
+    }
+    if (starts.empty() || *(const uint32_t *)(meta + starts.back()) != CHECKSUM_BLOCK)
+        return true;
+    const char *payload = meta + starts.back() + 8;
+    uint64_t payloadSize = size - starts.back() - 8;
+    uint32_t blocks = starts.size() - 1;
+    if (payloadSize < CHECKSUM_HEADER + 4 * blocks || *(const uint32_t *)(payload + 8) != blocks ||
+        *(const uint32_t *)payload != crc32c::value(payload + 4, payloadSize - 4))
+        return false;
+    for (uint32_t i = 0; i < blocks; ++i)
+    {
+        if (*(const uint32_t *)(payload + CHECKSUM_HEADER + 4 * i) != crc32c::value(meta + starts[i], starts[i + 1] - starts[i]))
+            return false;
+    }
+    checksum = starts.back() + 8;
+    return true;
+}
+
+// a partition is checked as its index entries, sequence numbers, value checksums and filter
+static uint32_t partitionCrc(const char *index, const char *seqs, const char *crcs, uint64_t length, const char *filter, uint64_t filterSize)
+{
+    uint32_t crc = crc32c::value(index, 12 * length);
+    crc = crc32c::extend(crc, seqs, 8 * length);
+    crc = crc32c::extend(crc, crcs, 4 * length);
+    return crc32c::extend(crc, filter, filterSize);
+}
+
+MappedFile::~MappedFile()
+{
+#ifndef _WIN32
+    munmap((void *)data, size);
+#endif
+}
+
+std::shared_ptr<MappedFile> MappedFile::map(const std::string &path, uint64_t size)
+{
+#ifdef _WIN32
+    return nullptr;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return nullptr;
+    // gets touch single values, reading ahead only wastes the page cache
+    madvise(addr, size, MADV_RANDOM);
+    return std::make_shared<MappedFile>((const char *)addr, size);
+#endif
+}
+
+TableBlocks::~TableBlocks()
+{
+    if (budget)
+    {
+        budget->release(MEM_FILTER, filterBytes());
+        budget->release(MEM_INDEX, indexBytes());
+    }
+}
+
+void TableBlocks::charge(MemoryBudget *budget)
+{
+    if (this->budget || !budget)
+        return;
+    this->budget = budget;
+    budget->charge(MEM_FILTER, filterBytes());
+    budget->charge(MEM_INDEX, indexBytes());
+}
+
+IndexPartitions::IndexPartitions(const char *buf, uint64_t size) : seqOffset(0), budget(nullptr)
+{
+    uint64_t count = size >= 8 ? *(const uint64_t *)buf : 0;
+    // a block this build cannot read leaves no partitions, the table is read whole
+    if (count > size / 24 || size != 32 + 24 * count)
+        return;
+    seqOffset = *(const uint64_t *)(buf + 8);
+    const uint64_t *pos = (const uint64_t *)(buf + 16);
+    firstKeys.assign(pos, pos + count);
+    starts.assign(pos + count, pos + 2 * count + 1);
+    filters.assign(pos + 2 * count + 1, pos + 3 * count + 2);
+}
+
+IndexPartitions::~IndexPartitions()
+{
+    if (budget)
+        budget->release(MEM_INDEX, byteSize());
+}
+
+int IndexPartitions::find(uint64_t key) const
+{
+    return std::upper_bound(firstKeys.begin(), firstKeys.end(), key) - firstKeys.begin() - 1;
+}
+
+void IndexPartitions::charge(MemoryBudget *budget)
+{
+    if (this->budget || !budget)
+        return;
+    this->budget = budget;
+    budget->charge(MEM_INDEX, byteSize());
+}
+
+vector<uint64_t> IndexPartitions::cut(const vector<INDEX> &index, uint32_t entries)
+{
+    vector<uint64_t> starts;
+    for (uint64_t i = 0; i < index.size(); ++i)
+    {
+        // a partition is full at entries, but holds on to the versions of its last key
+        if (starts.empty() || (i - starts.back() >= entries && index[i].Key != index[i - 1].Key))
+            starts.push_back(i);
+    }
+    starts.push_back(index.size());
+    return starts;
+}
+
+static std::atomic<uint64_t> nextTableId(1);
+// the whole filter and index of a table in the block cache, past any partition
+static const uint64_t WHOLE_TABLE = 0xffffff;
+static std::atomic<uint64_t> verifyClock(1);
+
+SSTableCache::SSTableCache() : pinned(std::make_shared<TableBlocks>()), blocks(pinned.get())
+{
+    pinned->BF.reset(new BloomFilter());
+    blockCache = nullptr;
+    unpinnedCache = nullptr;
+    id = nextTableId++;
+    // built from memory, every checksum was taken from the bytes written
+    crcOffset = 0;
+    verified = verifyClock++;
+    dataEnd = 0;
+    fileSize = 0;
+    maxSeq = 0;
+    tombstones = 0;
+    obsolete = false;
+    budget = nullptr;
+}
+
+SSTableCache::SSTableCache(const std::string &dir, BlockCache *blockCache)
+{
+    path = dir;
+    obsolete = false;
+    budget = nullptr;
+    this->blockCache = nullptr;
+    unpinnedCache = nullptr;
+    id = nextTableId++;
+    crcOffset = 0;
+    verified = 0;
+    if (blockCache)
+    {
+        load(true, false);
+        setBlockCache(blockCache);
+    }
+    // tables written without partitions are read whole all the same
+    if (!this->blockCache)
+    {
+        partitions.reset();
+        pinned = load(!blockCache);
+    }
+    blocks = pinned.get();
+    mapping = MappedFile::map(path, fileSize);
+}
+
+/**
+ * Read the filter and index from the file. With all, the header, range
+ * tombstones and properties are read into the cache as well. Without
+ * index only those are read, along with the top level of a partitioned
+ * index, and nothing is returned.
+ */
+std::shared_ptr<TableBlocks> SSTableCache::load(bool all, bool index)
+{
+    std::shared_ptr<TableBlocks> loaded = index ? std::make_shared<TableBlocks>() : nullptr;
+    vector<INDEX> Unread;
+    vector<INDEX> &Index = index ? loaded->Index : Unread;
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        printf("Fail to open file %s", path.c_str());
+        exit(-1);
+    }
+    file.seekg(0, std::ios::end);
+    uint64_t size = file.tellg();
+    file.seekg(0);
+    char headerBuf[32];
+    file.read(headerBuf, 32);
+    HEADER header;
+    memcpy(&header.timestamp, headerBuf, 8);
+    memcpy(&header.num, headerBuf + 8, 8);
+    memcpy(&header.min, headerBuf + 16, 8);
+    memcpy(&header.max, headerBuf + 24, 8);
+    // a torn header must not send the index read past the end of the file
+    if (!file || size < 10272 || header.num > (size - 10272) / 12)
+        corrupt(path);
+    if (all)
+        Header = header;
+    uint64_t length = header.num;
+    char *filterBuf = nullptr;
+    uint32_t headCrc = 0;
+    if (index)
+    {
+        filterBuf = new char[10240];
+        file.read(filterBuf, 10240);
+        char *indexBuf = new char[length * 12];
+        file.read(indexBuf, length * 12);
+        headCrc = crc32c::extend(crc32c::extend(crc32c::value(headerBuf, 32), filterBuf, 10240), indexBuf, length * 12);
+        Index.reserve(length);
+        for (unsigned i = 0; i < length; ++i)
+        {
+            Index.push_back(INDEX(*(uint64_t *)(indexBuf + 12 * i), *(uint32_t *)(indexBuf + 12 * i + 8)));
+        }
+        delete[] indexBuf;
+    }
+
+    // tables written before the footer existed end right after the data
+    if (all)
+    {
+        fileSize = size;
+        dataEnd = size;
+        maxSeq = 0;
+        tombstones = 0;
+        crcOffset = 0;
+    }
+    if (size >= 10272 + 12 * length + FOOTER_SIZE)
+    {
+        uint64_t metaOffset, magic;
+        file.seekg(size - FOOTER_SIZE);
+        file.read((char *)&metaOffset, 8);
+        file.read((char *)&magic, 8);
+        if (magic == TABLE_MAGIC)
+        {
+            if (metaOffset < 10272 + 12 * length || metaOffset > size - FOOTER_SIZE)
+                corrupt(path);
+            if (all)
+                dataEnd = metaOffset;
+            // the meta blocks are read at once, to be checked before they are used
+            vector<char> meta(size - FOOTER_SIZE - metaOffset);
+            file.seekg(metaOffset);
+            file.read(meta.data(), meta.size());
+            uint64_t checksum;
+            if (!file || !checkMeta(meta.data(), meta.size(), checksum))
+                corrupt(path);
+            const char *crcs = nullptr;
+            uint64_t crcCount = 0;
+            if (checksum < meta.size())
+            {
+                uint32_t blocks = *(const uint32_t *)&meta[checksum + 8];
+                crcCount = (meta.size() - checksum - CHECKSUM_HEADER) / 4 - blocks;
+                if (crcCount < length || (index && *(const uint32_t *)&meta[checksum + 4] != headCrc))
+                    corrupt(path);
+                crcs = &meta[checksum + CHECKSUM_HEADER + 4 * blocks];
+                if (all)
+                    crcOffset = metaOffset + (crcs - meta.data());
+                for (unsigned i = 0; index && i < length; ++i)
+                    Index[i].Crc = ((const uint32_t *)crcs)[i];
+            }
+            for (uint64_t pos = 0; pos + 8 <= meta.size();)
+            {
+                uint32_t type = *(const uint32_t *)&meta[pos], blockSize = *(const uint32_t *)&meta[pos + 4];
+                const char *block = &meta[pos + 8];
+                if (type == RANGE_DEL_BLOCK && all)
+                {
+                    for (uint32_t i = 0; i < blockSize / 24; ++i)
+                    {
+                        const uint64_t *fields = (const uint64_t *)(block + 24 * i);
+                        RangeDel.push_back(range(fields[0], fields[1], fields[2]));
+                        if (fields[2] > maxSeq)
+                            maxSeq = fields[2];
+                    }
+                }
+                else if (type == SEQ_BLOCK && blockSize == 8 * length && (index || all))
+                {
+                    for (unsigned i = 0; i < length; ++i)
+                    {
+                        uint64_t seq = ((const uint64_t *)block)[i];
+                        if (index)
+                            Index[i].Seq = seq;
+                        if (all && seq > maxSeq)
+                            maxSeq = seq;
+                    }
+                }
+                else if (type == FILTER_BLOCK && index)
+                    loaded->filter.reset(new FilterBlock(block, blockSize));
+                else if (type == INDEX_PARTITIONS_BLOCK && all && !index)
+                {
+                    partitions = std::make_shared<IndexPartitions>(block, blockSize);
+                    if (partitions->count() == 0)
+                        partitions.reset();
+                    else if (crcs)
+                    {
+                        // the partition checksums follow those of the values
+                        if (crcCount != length + partitions->count())
+                            corrupt(path);
+                        const uint32_t *partitionCrcs = (const uint32_t *)crcs + length;
+                        partitions->crcs.assign(partitionCrcs, partitionCrcs + partitions->count());
+                    }
+                }
+                else if (type == RANGE_FILTER_BLOCK && blockSize >= 16 && all)
+                    rangeFilter = std::make_shared<RangeFilter>(block, blockSize);
+                else if (type == PROPERTIES_BLOCK && blockSize >= 8 && all)
+                {
+                    // later properties are appended, what is not known here is skipped
+                    tombstones = *(const uint64_t *)block;
+                }
+                pos += 8 + blockSize;
+            }
+        }
+    }
+    file.close();
+    // a filter sized to the keys is kept instead of the fixed one
+    if (loaded && !loaded->filter)
+        loaded->BF.reset(new BloomFilter(filterBuf));
+    delete[] filterBuf;
+    return loaded;
+}
+
+/**
+ * One partition of the index and its filter, from the block cache or
+ * read from the file and put there for the next reader.
+ */
+std::shared_ptr<TableBlocks> SSTableCache::partition(uint32_t p, Statistics *stats)
+{
+    uint64_t key = id << 24 | p;
+    std::shared_ptr<TableBlocks> part;
+    if (blockCache->lookup(key, part))
+    {
+        if (stats)
+            stats->recordTick(BLOCK_CACHE_HIT);
+        return part;
+    }
+    if (stats)
+        stats->recordTick(BLOCK_CACHE_MISS);
+    part = readPartition(p);
+    blockCache->insert(key, part, part->filterBytes() + part->indexBytes());
+    return part;
+}
+
+std::shared_ptr<TableBlocks> SSTableCache::readPartition(uint32_t p)
+{
+    const IndexPartitions &top = *partitions;
+    uint64_t first = top.starts[p], length = top.starts[p + 1] - first;
+    bool last = p + 1 == top.count();
+    std::ifstream file;
+    if (!mapping)
+    {
+        file.open(path, std::ios::binary);
+        if (!file)
+        {
+            printf("Fail to open file %s", path.c_str());
+            exit(-1);
+        }
+    }
+    auto readAt = [&](uint64_t pos, char *buf, uint64_t size) {
+        if (mapping)
+            memcpy(buf, mapping->data + pos, size);
+        else
+        {
+            file.seekg(pos);
+            file.read(buf, size);
+        }
+        PERF_COUNT(reads, 1);
+        PERF_COUNT(bytesRead, size);
+    };
+    // the first entry of the next partition tells where this one's data ends
+    vector<char> indexBuf(12 * (length + (last ? 0 : 1)));
+    vector<char> seqBuf(8 * length);
+    vector<char> filterBuf(top.filters[p + 1] - top.filters[p]);
+    vector<char> crcBuf(crcOffset ? 4 * length : 0);
+    readAt(10272 + 12 * first, indexBuf.data(), indexBuf.size());
+    readAt(top.seqOffset + 8 * first, seqBuf.data(), seqBuf.size());
+    readAt(top.filters[p], filterBuf.data(), filterBuf.size());
+    if (crcOffset)
+    {
+        readAt(crcOffset + 4 * first, crcBuf.data(), crcBuf.size());
+        if (top.crcs.empty() ||
+            partitionCrc(indexBuf.data(), seqBuf.data(), crcBuf.data(), length, filterBuf.data(), filterBuf.size()) != top.crcs[p])
+            corrupt(path);
+    }
+    std::shared_ptr<TableBlocks> part = std::make_shared<TableBlocks>();
+    part->partition = p;
+    part->Index.reserve(length);
+    for (uint64_t i = 0; i < length; ++i)
+        part->Index.push_back(INDEX(*(uint64_t *)&indexBuf[12 * i], *(uint32_t *)&indexBuf[12 * i + 8], *(uint64_t *)&seqBuf[8 * i],
+                                    crcOffset ? *(uint32_t *)&crcBuf[4 * i] : 0));
+    part->end = last ? dataEnd : *(uint32_t *)&indexBuf[12 * length + 8];
+    part->filter.reset(new FilterBlock(filterBuf.data(), filterBuf.size()));
+    return part;
+}
+
+/**
+ * The filter and index for one lookup. Pinned blocks are handed out
+ * without taking a reference, the version the caller holds keeps them;
+ * those of an unpinned table come from the block cache, charged to the
+ * budget as cache, or are read from the file and put there.
+ */
+std::shared_ptr<TableBlocks> SSTableCache::acquire(Statistics *stats, bool fill)
+{
+    TableBlocks *current = blocks.load(std::memory_order_acquire);
+    if (current)
+        return std::shared_ptr<TableBlocks>(std::shared_ptr<TableBlocks>(), current);
+    std::shared_ptr<TableBlocks> loaded;
+    if (!unpinnedCache)
+    {
+        loaded = load(false);
+        loaded->charge(budget);
+        return loaded;
+    }
+    uint64_t key = id << 24 | WHOLE_TABLE;
+    if (unpinnedCache->lookup(key, loaded))
+    {
+        if (stats)
+            stats->recordTick(BLOCK_CACHE_HIT);
+        return loaded;
+    }
+    if (stats)
+        stats->recordTick(BLOCK_CACHE_MISS);
+    loaded = load(false);
+    if (fill)
+        unpinnedCache->insert(key, loaded, loaded->filterBytes() + loaded->indexBytes());
+    return loaded;
+}
+
+/**
+ * Stop keeping the filter and index in memory, lookups find them in
+ * cache from then on. The blocks are returned so the caller can keep
+ * them alive for readers that may still use them. Write lock held.
+ */
+std::shared_ptr<TableBlocks> SSTableCache::unpin(BlockCache *cache)
+{
+    unpinnedCache = cache;
+    blocks.store(nullptr, std::memory_order_release);
+    std::shared_ptr<TableBlocks> unpinned = pinned;
+    pinned.reset();
+    return unpinned;
+}
+
+void SSTableCache::setBudget(MemoryBudget *budget)
+{
+    this->budget = budget;
+    if (pinned)
+        pinned->charge(budget);
+    if (rangeFilter)
+        rangeFilter->charge(budget);
+    if (partitions)
+        partitions->charge(budget);
+}
+
+/**
+ * Read a partitioned table a partition at a time through blockCache,
+ * dropping the whole index and filter. Before the table is installed.
+ */
+void SSTableCache::setBlockCache(BlockCache *blockCache)
+{
+    if (!partitions || !blockCache)
+        return;
+    this->blockCache = blockCache;
+    blocks.store(nullptr, std::memory_order_release);
+    pinned.reset();
+}
+
+/**
+ * Hard-link the table into dir and return a cache for the new name, or
+ * nullptr if no link could be made. The data itself is not touched and
+ * the filter and index are shared with this cache.
+ */
+SSTableCache *SSTableCache::relink(const std::string &dir)
+{
+    std::string target = dir + path.substr(path.find_last_of('/'));
+    uint64_t num = 0;
+    while (std::ifstream(target).good())
+        target = dir + "/" + std::to_string(Header.timestamp) + "-" + std::to_string(num++) + ".sst";
+    if (utils::link(path.c_str(), target.c_str()) != 0)
+        return nullptr;
+    SSTableCache *cache = new SSTableCache();
+    cache->pinned = pinned;
+    cache->blocks = pinned.get();
+    cache->mapping = mapping;
+    cache->rangeFilter = rangeFilter;
+    cache->partitions = partitions;
+    cache->blockCache = blockCache;
+    cache->unpinnedCache = unpinnedCache;
+    cache->id = id;
+    cache->crcOffset = crcOffset;
+    cache->verified = verified.load();
+    cache->budget = budget;
+    cache->Header = Header;
+    cache->RangeDel = RangeDel;
+    cache->dataEnd = dataEnd;
+    cache->fileSize = fileSize;
+    cache->maxSeq = maxSeq;
+    cache->tombstones = tombstones;
+    cache->path = target;
+    return cache;
+}
+
+SSTableCache::~SSTableCache()
+{
+    // the file outlives compaction until the last reader lets go of it
+    if (obsolete)
+        utils::rmfile(path.c_str());
+}
+
+int SSTableCache::search(uint64_t key, uint64_t seq, std::shared_ptr<TableBlocks> &held, Statistics *stats)
+{
+    if (key > Header.max || key < Header.min || Header.num == 0)
+        return -1;
+    if (blockCache)
+    {
+        int p = partitions->find(key);
+        if (p < 0)
+            return -1;
+        held = partition(p, stats);
+    }
+    else
+        held = acquire(stats);
+    const vector<INDEX> &Index = held->Index;
+    PERF_COUNT(filterProbes, 1);
+    if (held->mayContain(key))
+    {
+        uint32_t steps = 0;
+        int pos = find(Index, key, 0, Index.size() - 1, steps);
+        PERF_COUNT(indexSteps, steps);
+        if (stats)
+            stats->recordTick(pos == -1 ? BLOOM_FALSE_POSITIVE : BLOOM_TRUE_POSITIVE);
+        if (pos == -1)
+            return -1;
+        // versions of a key sit next to each other, newest first
+        while (pos > 0 && Index[pos - 1].Key == key)
+            --pos;
+        while ((uint32_t)pos < Index.size() && Index[pos].Key == key && Index[pos].Seq > seq)
+            ++pos;
+        if ((uint32_t)pos == Index.size() || Index[pos].Key != key)
+            return -1;
+        return pos;
+    }
+    if (stats)
+        stats->recordTick(BLOOM_USEFUL);
+    PERF_COUNT(filterRejections, 1);
+    return -1;
+}
+
+int SSTableCache::find(const vector<INDEX> &Index, uint64_t key, int lo, int hi, uint32_t &steps)
+{
+    ++steps;
+    if (lo > hi)
+        return -1;
+    if (lo == hi)
+    {
+        if (Index[lo].Key == key)
+            return lo;
+        else
+            return -1;
+    }
+    int mi = (hi + lo) >> 1;
+    if (Index[mi].Key == key)
+        return mi;
+    else if (Index[mi].Key < key)
+        return find(Index, key, mi + 1, hi, steps);
+    else
+        return find(Index, key, lo, mi - 1, steps);
+}
+
+int SSTableCache::lowpos(uint64_t key1, uint64_t key2, std::shared_ptr<TableBlocks> &held, Statistics *stats)
+{
+    if (key1 > (Header).max || key2 < (Header).min || Header.num == 0)
+        return -1;
+    uint64_t lo, hi;
+    lo = max((Header).min, key1);
+    hi = min((Header).max, key2);
+    // settled without the index, which an unpinned table would have to read
+    if (rangeFilter && !rangeFilter->mayContain(lo, hi))
+    {
+        if (stats)
+            stats->recordTick(RANGE_FILTER_USEFUL);
+        PERF_COUNT(filterRejections, 1);
+        return -1;
+    }
+    int p = 0;
+    if (blockCache)
+    {
+        p = max(partitions->find(lo), 0);
+        held = partition(p, stats);
+    }
+    else
+        held = acquire(stats);
+    const vector<INDEX> &Index = held->Index;
+    uint32_t steps = 0;
+    int Lowpos = find2(Index, 0, Index.size() - 1, lo, hi, steps);
+    PERF_COUNT(indexSteps, steps);
+    // all of the partition lies below lo, the range starts the next one
+    if (Lowpos == -1 && blockCache && (uint32_t)p + 1 < partitions->count() && partitions->firstKeys[p + 1] <= hi)
+    {
+        held = partition(p + 1, stats);
+        return 0;
+    }
+    if (Lowpos == -1)
+        return -1;
+    while (Lowpos != 0)
+    {
+        if (Index[Lowpos - 1].Key >= key1 && Index[Lowpos - 1].Key <= key2)
+            Lowpos--;
+        else
+            break;
+    }
+    return Lowpos;
+}
+
+bool SSTableCache::nextBlocks(std::shared_ptr<TableBlocks> &held, Statistics *stats)
+{
+    if (!blockCache || held->partition + 1 >= partitions->count())
+        return false;
+    held = partition(held->partition + 1, stats);
+    return true;
+}
+
+uint32_t SSTableCache::valueLength(const TableBlocks *held, int pos)
+{
+    const vector<INDEX> &Index = held->Index;
+    // the blocks of a whole table end where the data does
+    if ((uint32_t)pos == Index.size() - 1)
+        return (held->end ? held->end : dataEnd) - Index[pos].Offset;
+    return Index[pos + 1].Offset - Index[pos].Offset;
+}
+
+void SSTableCache::checkValue(const INDEX &index, const char *data, uint32_t length) const
+{
+    if (crcOffset && crc32c::value(data, length) != index.Crc)
+        corrupt(path);
+}
+
+/**
+ * Read the table back at low priority and check the head, every meta
+ * block, partition and value against their checksums, the way the
+ * scrubber visits files no reader has checked in a while. Tables
+ * written without checksums pass once their footer and meta blocks
+ * are found to fit the file.
+ */
+bool SSTableCache::verify(RateLimiter *limiter)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    file.seekg(0, std::ios::end);
+    uint64_t size = file.tellg();
+    file.seekg(0);
+    vector<char> buf(size);
+    // in pieces no larger than what the limiter grants at once
+    for (uint64_t done = 0; done < size; done += VERIFY_PIECE)
+    {
+        uint64_t piece = min(VERIFY_PIECE, size - done);
+        if (limiter)
+            limiter->request(piece, IO_LOW);
+        file.read(&buf[done], piece);
+    }
+    // a table that fails is not visited again before the others
+    verified = verifyClock++;
+    const char *data = buf.data();
+    if (!file || size < 10272 + FOOTER_SIZE)
+        return false;
+    uint64_t length = *(const uint64_t *)(data + 8);
+    if (length > (size - 10272 - FOOTER_SIZE) / 12)
+        return false;
+    if (*(const uint64_t *)(data + size - 8) != TABLE_MAGIC)
+        return true;
+    uint64_t metaOffset = *(const uint64_t *)(data + size - FOOTER_SIZE);
+    if (metaOffset < 10272 + 12 * length || metaOffset > size - FOOTER_SIZE)
+        return false;
+    const char *meta = data + metaOffset;
+    uint64_t metaBytes = size - FOOTER_SIZE - metaOffset, checksum;
+    if (!checkMeta(meta, metaBytes, checksum))
+        return false;
+    if (checksum == metaBytes)
+        return true;
+    uint32_t blocks = *(const uint32_t *)(meta + checksum + 8);
+    uint64_t crcCount = (metaBytes - checksum - CHECKSUM_HEADER) / 4 - blocks;
+    if (crcCount < length || *(const uint32_t *)(meta + checksum + 4) != crc32c::value(data, 10272 + 12 * length))
+        return false;
+    const uint32_t *crcs = (const uint32_t *)(meta + checksum + CHECKSUM_HEADER + 4 * blocks);
+    for (uint64_t i = 0; i < length; ++i)
+    {
+        uint64_t offset = *(const uint32_t *)(data + 10272 + 12 * i + 8);
+        uint64_t end = i + 1 < length ? *(const uint32_t *)(data + 10272 + 12 * (i + 1) + 8) : metaOffset;
+        if (offset > end || end > metaOffset || crc32c::value(data + offset, end - offset) != crcs[i])
+            return false;
+    }
+    // the checksums of partitions cover what a reader of one reads
+    for (uint64_t pos = 0; pos + 8 < checksum; pos += 8 + *(const uint32_t *)(meta + pos + 4))
+    {
+        if (*(const uint32_t *)(meta + pos) != INDEX_PARTITIONS_BLOCK)
+            continue;
+        IndexPartitions top(meta + pos + 8, *(const uint32_t *)(meta + pos + 4));
+        if (top.count() == 0 || crcCount != length + top.count() || top.starts.back() != length || top.seqOffset + 8 * length > size)
+            return false;
+        for (uint32_t p = 0; p < top.count(); ++p)
+        {
+            uint64_t first = top.starts[p], count = top.starts[p + 1] - first;
+            if (top.starts[p] > top.starts[p + 1] || top.filters[p] > top.filters[p + 1] || top.filters[p + 1] > size)
+                return false;
+            if (partitionCrc(data + 10272 + 12 * first, data + top.seqOffset + 8 * first, (const char *)(crcs + first), count,
+                             data + top.filters[p], top.filters[p + 1] - top.filters[p]) != crcs[length + p])
+                return false;
+        }
+    }
+    return true;
+}
+
+int SSTableCache::find2(const vector<INDEX> &Index, int lo, int hi, uint64_t key1, uint64_t key2, uint32_t &steps)
+{
+    ++steps;
+    if (lo > hi)
+        return -1;
+    if (lo == hi)
+    {
+        if (Index[lo].Key >= key1 && Index[lo].Key <= key2)
+            return lo;
+        else
+            return -1;
+    }
+    int mi = (hi + lo) >> 1;
+    if (Index[mi].Key >= key1 && Index[mi].Key <= key2)
+        return mi;
+    else if (Index[mi].Key > key2)
+        return find2(Index, lo, mi - 1, key1, key2, steps);
+    else
+        return find2(Index, mi + 1, hi, key1, key2, steps);
+}
+
+// compaction input, read at low priority when a limiter is given.
+// Only keys in [lo, hi] are read and range tombstones are clipped to it.
+SSTable::SSTable(SSTableCache *cache, RateLimiter *limiter, uint64_t lo, uint64_t hi)
+{
+    path = cache->path;
+    timeStamp = cache->Header.timestamp;
+    for (auto it = cache->RangeDel.begin(); it != cache->RangeDel.end(); ++it)
+    {
+        if ((*it).max >= lo && (*it).min <= hi)
+            RangeDel.push_back(range(max((*it).min, lo), min((*it).max, hi), (*it).seq));
+    }
+    std::shared_ptr<TableBlocks> blocks = cache->acquire(nullptr, false);
+    const vector<INDEX> &Index = blocks->Index;
+    uint32_t first = std::lower_bound(Index.begin(), Index.end(), lo,
+                                      [](const INDEX &index, uint64_t key) { return index.Key < key; }) -
+                     Index.begin();
+    uint32_t last = std::upper_bound(Index.begin(), Index.end(), hi,
+                                     [](uint64_t key, const INDEX &index) { return key < index.Key; }) -
+                    Index.begin();
+    length = last > first ? last - first : 0;
+    if (length == 0)
+        return;
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        printf("Fail to open file %s", path.c_str());
+        exit(-1);
+    }
+    uint32_t end = last < Index.size() ? Index[last].Offset : cache->dataEnd;
+    if (limiter)
+        limiter->request(end - Index[first].Offset, IO_LOW);
+    file.seekg(Index[first].Offset);
+    for (uint32_t i = first; i < last; ++i)
+    {
+        uint32_t valLen = cache->valueLength(blocks.get(), i);
+        char *buf = new char[valLen + 1];
+        buf[valLen] = '\0';
+        file.read(buf, valLen);
+        cache->checkValue(Index[i], buf, valLen);
+        Entries.push_back(ENTRY(Index[i].Key, Index[i].Seq, std::string(buf)));
+        delete[] buf;
+    }
+}
+
+void SSTable::merge(std::vector<SSTable> &tables)
+{
+    uint64_t size = tables.size();
+    if (size == 1)
+        return;
+    uint32_t group = size / 2;
+    std::vector<SSTable> next;
+    for (uint32_t i = 0; i < group; ++i)
+    {
+        next.push_back(merge2(tables[2 * i], tables[2 * i + 1]));
+    }
+    if (size % 2 == 1)
+        next.push_back(tables[size - 1]);
+    merge(next);
+    tables = next;
+}
+
+std::vector<SSTableCache *> SSTable::save(const std::string &dir, const TableWriteOptions &options, uint64_t firstNum, uint64_t numStep)
+{
+    std::vector<SSTableCache *> caches;
+    SSTable newTable;
+    // parallel savers into one directory number their tables apart
+    uint64_t num = firstNum;
+    newTable.addRangeDel(RangeDel);
+    while (!Entries.empty())
+    {
+        // never split the versions of one key across two tables
+        if (newTable.length > 0 && Entries.front().key != newTable.Entries.back().key &&
+            newTable.size + 12 + Entries.front().val.size() + metaSize(newTable.RangeDel, newTable.length + 1, options) >= MAX_TABLE_SIZE)
+        {
+            caches.push_back(newTable.saveSingle(dir, timeStamp, num, options, numStep));
+            num += numStep;
+            newTable = SSTable();
+        }
+        newTable.add(Entries.front());
+        Entries.pop_front();
+    }
+    if (newTable.length > 0 || !newTable.RangeDel.empty())
+    {
+        caches.push_back(newTable.saveSingle(dir, timeStamp, num, options, numStep));
+    }
+    return caches;
+}
+
+SSTable SSTable::merge2(SSTable &a, SSTable &b)
+{
+    SSTable result;
+    result.timeStamp = max(a.timeStamp, b.timeStamp);
+    // all versions are kept here, purge() decides which ones survive
+    while ((!a.Entries.empty()) && (!b.Entries.empty()))
+    {
+        ENTRY &aEntry = a.Entries.front(), &bEntry = b.Entries.front();
+        if (aEntry.key > bEntry.key || (aEntry.key == bEntry.key && aEntry.seq < bEntry.seq))
+        {
+            result.Entries.push_back(bEntry);
+            b.Entries.pop_front();
+        }
+        else
+        {
+            result.Entries.push_back(aEntry);
+            a.Entries.pop_front();
+        }
+    }
+    while (!a.Entries.empty())
+    {
+        result.Entries.push_back(a.Entries.front());
+        a.Entries.pop_front();
+    }
+    while (!b.Entries.empty())
+    {
+        result.Entries.push_back(b.Entries.front());
+        b.Entries.pop_front();
+    }
+    result.RangeDel = a.RangeDel;
+    result.RangeDel.insert(result.RangeDel.end(), b.RangeDel.begin(), b.RangeDel.end());
+    return result;
+}
+
+void SSTable::purge(const std::multiset<uint64_t> &snapshots, bool bottom)
+{
+    uint64_t lastKey = 0, newerSeq = UINT64_MAX;
+    for (auto it = Entries.begin(); it != Entries.end();)
+    {
+        if ((*it).key != lastKey)
+            newerSeq = UINT64_MAX;
+        lastKey = (*it).key;
+        uint64_t hideSeq = min(newerSeq, hiddenSeq(RangeDel, (*it).key, (*it).seq));
+        newerSeq = (*it).seq;
+        if (needVersion((*it).seq, hideSeq, snapshots))
+            ++it;
+        else
+            it = Entries.erase(it);
+    }
+    if (!bottom)
+        return;
+    // nothing lies below, so a tombstone with no older version left hides nothing
+    for (auto it = Entries.end(); it != Entries.begin();)
+    {
+        --it;
+        auto older = std::next(it);
+        if ((*it).val == "~DELETED~" && (older == Entries.end() || (*older).key != (*it).key))
+            it = Entries.erase(it);
+    }
+    // a range tombstone only matters to snapshots older than itself
+    for (auto it = RangeDel.begin(); it != RangeDel.end();)
+    {
+        if (snapshots.empty() || *snapshots.begin() >= (*it).seq)
+            it = RangeDel.erase(it);
+        else
+            ++it;
+    }
+}
+
+bool cacheTimeCompare(const std::shared_ptr<SSTableCache> &a, const std::shared_ptr<SSTableCache> &b)
+{
+    return (a->Header).timestamp > (b->Header).timestamp;
+}
+
+bool haveIntersection(const SSTableCache *cache, const std::vector<range> &ranges)
+{
+    unsigned long long min = (cache->Header).min;
+    unsigned long long max = (cache->Header).max;
+    for (auto it = ranges.begin(); it != ranges.end(); ++it)
+    {
+        if (!((*it).max < min || (*it).min > max))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool disjointRanges(std::vector<range> ranges)
+{
+    std::sort(ranges.begin(), ranges.end(), [](const range &a, const range &b) { return a.min < b.min; });
+    for (uint32_t i = 1; i < ranges.size(); ++i)
+    {
+        if (ranges[i].min <= ranges[i - 1].max)
+            return false;
+    }
+    return true;
+}
+
+bool tableTimecompare(SSTable &a, SSTable &b)
+{
+    return a.timeStamp > b.timeStamp;
+}
+
+uint64_t coveringSeq(const std::vector<range> &ranges, uint64_t key, uint64_t seq)
+{
+    uint64_t result = 0;
+    for (auto it = ranges.begin(); it != ranges.end(); ++it)
+    {
+        if ((*it).min <= key && key <= (*it).max && (*it).seq <= seq && (*it).seq > result)
+            result = (*it).seq;
+    }
+    return result;
+}
+
+uint64_t containingSeq(const std::vector<range> &ranges, uint64_t min, uint64_t max)
+{
+    uint64_t result = 0;
+    for (auto it = ranges.begin(); it != ranges.end(); ++it)
+    {
+        if ((*it).min <= min && max <= (*it).max && (*it).seq > result)
+            result = (*it).seq;
+    }
+    return result;
+}
+
+uint64_t hiddenSeq(const std::vector<range> &ranges, uint64_t key, uint64_t seq)
+{
+    uint64_t result = UINT64_MAX;
+    for (auto it = ranges.begin(); it != ranges.end(); ++it)
+    {
+        if ((*it).min <= key && key <= (*it).max && (*it).seq > seq && (*it).seq < result)
+            result = (*it).seq;
+    }
+    return result;
+}
+
+bool snapshotBetween(const std::multiset<uint64_t> &snapshots, uint64_t lo, uint64_t hi)
+{
+    auto it = snapshots.lower_bound(lo);
+    return it != snapshots.end() && *it < hi;
+}
+
+bool needVersion(uint64_t seq, uint64_t hideSeq, const std::multiset<uint64_t> &snapshots)
+{
+    return hideSeq == UINT64_MAX || snapshotBetween(snapshots, seq, hideSeq);
+}
+
+// at most what saveMeta writes; partitions of a table are known only once its keys are
+uint64_t metaSize(const std::vector<range> &rangeDel, uint64_t num, const TableWriteOptions &options)
+{
+    uint64_t size = 0, parts = 0;
+    if (num > 0)
+        size += 8 + 8 * num + 8 + 8;
+    if (num > 0 && options.rangeFilterBitsPerKey > 0)
+        size += 8 + RangeFilter::byteSize(num, options.rangeFilterBitsPerKey);
+    if (num > 0 && options.indexPartitionEntries > 0)
+    {
+        // every partition but the last is full; each filter has the overhead
+        // of an empty one and rounds its size up by a few words
+        parts = (num + options.indexPartitionEntries - 1) / options.indexPartitionEntries;
+        size += 8 + 16 + 24 * parts + 16;
+        size += 8 + FilterBlock::byteSize(num, options.partitionFilterBitsPerKey, options.filterType) +
+                parts * (FilterBlock::byteSize(0, options.partitionFilterBitsPerKey, options.filterType) + 24);
+    }
+    if (num > 0 && options.filterBitsPerKey > 0)
+        size += 8 + FilterBlock::byteSize(num, options.filterBitsPerKey, options.filterType);
+    if (!rangeDel.empty())
+        size += 8 + 24 * rangeDel.size();
+    size += 8 + CHECKSUM_HEADER + 4 * (MAX_META_BLOCKS + num + parts);
+    return size;
+}
+
+/**
+ * The meta blocks and the footer, written to meta, which goes at
+ * metaOffset; returns their size. The checksum block comes last: the
+ * checksum of its own payload, headCrc of the header, fixed filter and
+ * index in front of the data, the count of blocks before it and their
+ * checksums, then those of the values and of the index partitions.
+ */
+uint64_t saveMeta(char *meta, uint64_t metaOffset, const std::vector<INDEX> &index, const std::vector<range> &rangeDel, uint64_t tombstones,
+                  uint32_t headCrc, const RangeFilter *rangeFilter, const TableWriteOptions &options)
+{
+    char *begin = meta;
+    vector<char *> blocks;
+    vector<uint32_t> partitionCrcs;
+    if (!index.empty())
+    {
+        blocks.push_back(meta);
+        *(uint32_t *)meta = SEQ_BLOCK;
+        *(uint32_t *)(meta + 4) = 8 * index.size();
+        meta += 8;
+        for (auto it = index.begin(); it != index.end(); ++it)
+        {
+            *(uint64_t *)meta = (*it).Seq;
+            meta += 8;
+        }
+        blocks.push_back(meta);
+        *(uint32_t *)meta = PROPERTIES_BLOCK;
+        *(uint32_t *)(meta + 4) = 8;
+        *(uint64_t *)(meta + 8) = tombstones;
+        meta += 16;
+    }
+    if (rangeFilter)
+    {
+        blocks.push_back(meta);
+        *(uint32_t *)meta = RANGE_FILTER_BLOCK;
+        *(uint32_t *)(meta + 4) = rangeFilter->byteSize();
+        rangeFilter->saveBuffer(meta + 8);
+        meta += 8 + rangeFilter->byteSize();
+    }
+    if (!index.empty() && options.filterBitsPerKey > 0)
+    {
+        vector<uint64_t> keys;
+        keys.reserve(index.size());
+        for (auto it = index.begin(); it != index.end(); ++it)
+            keys.push_back((*it).Key);
+        FilterBlock filter(keys, options.filterBitsPerKey, options.filterType);
+        blocks.push_back(meta);
+        *(uint32_t *)meta = FILTER_BLOCK;
+        *(uint32_t *)(meta + 4) = filter.byteSize();
+        filter.saveBuffer(meta + 8);
+        meta += 8 + filter.byteSize();
+    }
+    if (!index.empty() && options.indexPartitionEntries > 0)
+    {
+        vector<uint64_t> starts = IndexPartitions::cut(index, options.indexPartitionEntries);
+        uint64_t parts = starts.size() - 1;
+        // the filters first, the top level records where they went
+        vector<uint64_t> filters;
+        char *filterBlock = meta;
+        blocks.push_back(meta);
+        meta += 8;
+        for (uint64_t p = 0; p < parts; ++p)
+        {
+            vector<uint64_t> keys;
+            // the partition as a reader finds it in the head and the sequence block
+            vector<char> entries(12 * (starts[p + 1] - starts[p])), crcs(4 * (starts[p + 1] - starts[p]));
+            for (uint64_t i = starts[p]; i < starts[p + 1]; ++i)
+            {
+                keys.push_back(index[i].Key);
+                memcpy(&entries[12 * (i - starts[p])], &index[i].Key, 8);
+                memcpy(&entries[12 * (i - starts[p]) + 8], &index[i].Offset, 4);
+                memcpy(&crcs[4 * (i - starts[p])], &index[i].Crc, 4);
+            }
+            FilterBlock filter(keys, options.partitionFilterBitsPerKey, options.filterType);
+            filters.push_back(metaOffset + (meta - begin));
+            filter.saveBuffer(meta);
+            partitionCrcs.push_back(partitionCrc(entries.data(), begin + 8 + 8 * starts[p], crcs.data(), keys.size(), meta, filter.byteSize()));
+            meta += filter.byteSize();
+        }
+        filters.push_back(metaOffset + (meta - begin));
+        *(uint32_t *)filterBlock = FILTER_PARTITIONS_BLOCK;
+        *(uint32_t *)(filterBlock + 4) = meta - filterBlock - 8;
+        blocks.push_back(meta);
+        *(uint32_t *)meta = INDEX_PARTITIONS_BLOCK;
+        *(uint32_t *)(meta + 4) = 16 + 24 * parts + 16;
+        *(uint64_t *)(meta + 8) = parts;
+        // the sequence block comes first
+        *(uint64_t *)(meta + 16) = metaOffset + 8;
+        meta += 24;
+        for (uint64_t p = 0; p < parts; ++p, meta += 8)
+            *(uint64_t *)meta = index[starts[p]].Key;
+        for (uint64_t p = 0; p <= parts; ++p, meta += 8)
+            *(uint64_t *)meta = starts[p];
+        for (uint64_t p = 0; p <= parts; ++p, meta += 8)
+            *(uint64_t *)meta = filters[p];
+    }
+    if (!rangeDel.empty())
+    {
+        blocks.push_back(meta);
+        *(uint32_t *)meta = RANGE_DEL_BLOCK;
+        *(uint32_t *)(meta + 4) = 24 * rangeDel.size();
+        meta += 8;
+        for (auto it = rangeDel.begin(); it != rangeDel.end(); ++it)
+        {
+            *(uint64_t *)meta = (*it).min;
+            *(uint64_t *)(meta + 8) = (*it).max;
+            *(uint64_t *)(meta + 16) = (*it).seq;
+            meta += 24;
+        }
+    }
+    blocks.push_back(meta);
+    char *checksums = meta + 8;
+    *(uint32_t *)meta = CHECKSUM_BLOCK;
+    *(uint32_t *)(meta + 4) = CHECKSUM_HEADER + 4 * (blocks.size() - 1 + index.size() + partitionCrcs.size());
+    *(uint32_t *)(checksums + 4) = headCrc;
+    *(uint32_t *)(checksums + 8) = blocks.size() - 1;
+    *(uint32_t *)(checksums + 12) = 0;
+    meta = checksums + CHECKSUM_HEADER;
+    for (uint32_t i = 0; i + 1 < blocks.size(); ++i, meta += 4)
+        *(uint32_t *)meta = crc32c::value(blocks[i], blocks[i + 1] - blocks[i]);
+    for (auto it = index.begin(); it != index.end(); ++it, meta += 4)
+        *(uint32_t *)meta = (*it).Crc;
+    for (auto it = partitionCrcs.begin(); it != partitionCrcs.end(); ++it, meta += 4)
+        *(uint32_t *)meta = *it;
+    *(uint32_t *)checksums = crc32c::value(checksums + 4, meta - checksums - 4);
+    *(uint64_t *)meta = metaOffset;
+    *(uint64_t *)(meta + 8) = TABLE_MAGIC;
+    return meta + FOOTER_SIZE - begin;
+}
+
+void SSTable::add(ENTRY &entry)
+{
+    size += 12 + entry.val.size();
+    length++;
+    Entries.push_back(entry);
+}
+
+void SSTable::addRangeDel(const std::vector<range> &ranges)
+{
+    RangeDel.insert(RangeDel.end(), ranges.begin(), ranges.end());
+}
+
+SSTableCache *SSTable::saveSingle(const std::string &dir, const uint64_t &currentTime, const uint64_t &num, const TableWriteOptions &options,
+                                  uint64_t numStep)
+{
+    // an input or an obsolete table still held by a reader may own this
+    // name; the next one tried is still among the numbers of this saver
+    uint64_t fileNum = num;
+    std::string filename = dir + "/" + std::to_string(currentTime) + "-" + std::to_string(fileNum) + ".sst";
+    while (std::ifstream(filename).good())
+    {
+        fileNum += numStep;
+        filename = dir + "/" + std::to_string(currentTime) + "-" + std::to_string(fileNum) + ".sst";
+    }
+    TableBuilder builder(filename, length, size + metaSize(RangeDel, length, options), IO_LOW, options);
+    for (auto it = Entries.begin(); it != Entries.end(); ++it)
+        builder.add((*it).key, (*it).seq, (*it).val);
+    return builder.finish(currentTime, RangeDel);
+}
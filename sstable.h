@@ -1,82 +1,268 @@
-#ifndef SSTABLE_H
-#define SSTABLE_H
-
-#include "bloomfilter.h"
-#include <time.h>
-#include <climits>
-#include <vector>
-#include <iostream>
-#include <fstream>
-#include <list>
-
-#define MAX_TABLE_SIZE 2097152
-
-using namespace std;
-
-struct HEADER
-{
-    uint64_t timestamp;
-    uint64_t num;
-    uint64_t min;
-    uint64_t max;
-    HEADER()
-    {
-        timestamp = time(NULL);
-        num = 0;
-        min = INT_MAX;
-        max = INT_MIN;
-    }
-};
-
-struct INDEX
-{
-    uint64_t Key;
-    uint32_t Offset;
-    INDEX(uint64_t k = 0, uint32_t o = 0) : Key(k), Offset(o) {}
-};
-
-class SSTableCache
-{
-public:
-    HEADER Header;
-    BloomFilter *BF;
-    vector<INDEX> Index;
-    std::string path;
-    SSTableCache();
-    SSTableCache(const std::string &dir);
-    int search(uint64_t key);
-    int lowpos(uint64_t key1, uint64_t key2);
-    ~SSTableCache() { delete BF; }
-
-private:
-    int find(uint64_t key, int lo, int hi);
-    int find2(int lo, int hi, uint64_t key1, uint64_t key2);
-};
-
-struct range
-{
-    uint64_t min, max;
-    range(uint64_t in, uint64_t ax) : min(in), max(ax) {}
-};
-
-class SSTable
-{
-public:
-    uint64_t timeStamp;
-    std::string path;
-    uint64_t size;
-    uint64_t length;
-    std::list<std::pair<uint64_t, std::string>> Entries;
-    SSTable(SSTableCache *cache);
-    SSTable() : size(10272), length(0) {}
-    std::vector<SSTableCache *> save(const std::string &dir);
-    static void merge(std::vector<SSTable> &tables);
-    static SSTable merge2(SSTable &a, SSTable &b);
-    void add(std::pair<uint64_t, std::string> &);
-    SSTableCache *saveSingle(const std::string &dir, const uint64_t &currentTime, const uint64_t &num);
-};
-
-bool cacheTimeCompare(SSTableCache *a, SSTableCache *b);
-bool haveIntersection(const SSTableCache *cache, const std::vector<range> &ranges);
-bool tableTimecompare(SSTable &a, SSTable &b);
-#endif // SSTABLE_H
+#ifndef SSTABLE_H
+#define SSTABLE_H
+
+#include "bloomfilter.h"
+#include "ratelimiter.h"
+#include "statistics.h"
+#include "perfcontext.h"
+#include "memorybudget.h"
+#include "rangefilter.h"
+#include "filterblock.h"
+#include "blockcache.h"
+#include <time.h>
+#include <climits>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <list>
+#include <set>
+#include <memory>
+#include <atomic>
+
+#define MAX_TABLE_SIZE 2097152
+#define FOOTER_SIZE 16
+#define TABLE_MAGIC 0x4c534d5441424c45ULL
+
+enum MetaBlockType
+{
+    RANGE_DEL_BLOCK = 1,
+    SEQ_BLOCK,
+    PROPERTIES_BLOCK,
+    RANGE_FILTER_BLOCK,
+    INDEX_PARTITIONS_BLOCK,
+    FILTER_PARTITIONS_BLOCK,
+    FILTER_BLOCK,
+    // always the last block, see saveMeta
+    CHECKSUM_BLOCK
+};
+
+using namespace std;
+
+struct HEADER
+{
+    uint64_t timestamp;
+    uint64_t num;
+    uint64_t min;
+    uint64_t max;
+    HEADER()
+    {
+        timestamp = time(NULL);
+        num = 0;
+        min = INT_MAX;
+        max = INT_MIN;
+    }
+};
+
+struct INDEX
+{
+    uint64_t Key;
+    uint32_t Offset;
+    // CRC32C of the value, in what would be padding after Offset
+    uint32_t Crc;
+    uint64_t Seq;
+    INDEX(uint64_t k = 0, uint32_t o = 0, uint64_t s = 0, uint32_t c = 0) : Key(k), Offset(o), Crc(c), Seq(s) {}
+};
+
+struct ENTRY
+{
+    uint64_t key;
+    uint64_t seq;
+    std::string val;
+    ENTRY(uint64_t k, uint64_t s, const std::string &v) : key(k), seq(s), val(v) {}
+};
+
+/**
+ * How tables are written. Writes are throttled by the rate limiter if
+ * set, bypass the page cache with directWrites where the file system
+ * allows it, and are written back every bytesPerSync bytes on the way
+ * (0 leaves it all to the sync at the end). With rangeFilterBitsPerKey
+ * each table gets a range filter of that many bits per key. With
+ * indexPartitionEntries the index is also cut into partitions of about
+ * that many entries, each with a filter of partitionFilterBitsPerKey, so
+ * a reader can load the part of the index it needs. With filterBitsPerKey
+ * each table also gets a filter of filterType sized to its keys, which
+ * readers keep in place of the fixed whole-table Bloom filter; partition
+ * filters are of filterType too.
+ */
+struct TableWriteOptions
+{
+    RateLimiter *rateLimiter;
+    bool directWrites;
+    uint64_t bytesPerSync;
+    uint32_t rangeFilterBitsPerKey;
+    uint32_t indexPartitionEntries;
+    uint32_t partitionFilterBitsPerKey;
+    uint32_t filterBitsPerKey;
+    FilterType filterType;
+    TableWriteOptions() : rateLimiter(nullptr), directWrites(false), bytesPerSync(1048576), rangeFilterBitsPerKey(0),
+                          indexPartitionEntries(0), partitionFilterBitsPerKey(10), filterBitsPerKey(0), filterType(BLOOM_FILTER) {}
+};
+
+struct range
+{
+    uint64_t min, max;
+    uint64_t seq;
+    range(uint64_t in, uint64_t ax, uint64_t s = 0) : min(in), max(ax), seq(s) {}
+};
+
+/**
+ * The filter and index of a table, the part of it kept in memory, or of
+ * one partition of a partitioned table: then filter takes the place of
+ * the whole-table BF, and end is where the value of the last entry ends.
+ * Once charged to a budget the bytes are released when the blocks go.
+ */
+struct TableBlocks
+{
+    std::unique_ptr<BloomFilter> BF;
+    std::unique_ptr<FilterBlock> filter;
+    vector<INDEX> Index;
+    uint32_t partition;
+    uint32_t end;
+    MemoryBudget *budget;
+    TableBlocks() : partition(0), end(0), budget(nullptr) {}
+    ~TableBlocks();
+    bool mayContain(uint64_t key) const { return filter ? filter->mayContain(key) : BF->isExisted(key); }
+    uint64_t filterBytes() const { return BF ? sizeof(BloomFilter) : filter ? filter->byteSize() : 0; }
+    uint64_t indexBytes() const { return Index.capacity() * sizeof(INDEX); }
+    void charge(MemoryBudget *budget);
+};
+
+/**
+ * The top level of a partitioned index, kept in memory in place of the
+ * index and filter: the first key of each partition, where it starts in
+ * the index and where its filter is. The versions of a key are never
+ * split between partitions, so the last partition starting at or below
+ * a key is the only one that may hold it.
+ */
+struct IndexPartitions
+{
+    vector<uint64_t> firstKeys;
+    // one more than there are partitions, the last ones end the table
+    vector<uint64_t> starts;
+    vector<uint64_t> filters;
+    // checksum of each partition, empty for tables written without checksums
+    vector<uint32_t> crcs;
+    uint64_t seqOffset;
+    MemoryBudget *budget;
+    IndexPartitions(const char *buf, uint64_t size);
+    ~IndexPartitions();
+    uint32_t count() const { return firstKeys.size(); }
+    // -1 when the key comes before the table
+    int find(uint64_t key) const;
+    uint64_t byteSize() const { return (firstKeys.capacity() + starts.capacity() + filters.capacity()) * 8 + crcs.capacity() * 4; }
+    void charge(MemoryBudget *budget);
+    // where partitions of about entries entries start in index
+    static vector<uint64_t> cut(const vector<INDEX> &index, uint32_t entries);
+};
+
+/**
+ * A table file mapped read-only for gets. What is handed out of it stays
+ * valid while the mapping is held, even after the file was unlinked.
+ */
+struct MappedFile
+{
+    const char *data;
+    uint64_t size;
+    MappedFile(const char *data, uint64_t size) : data(data), size(size) {}
+    ~MappedFile();
+    // null where the file cannot be mapped, readers then read it instead
+    static std::shared_ptr<MappedFile> map(const std::string &path, uint64_t size);
+};
+
+class SSTableCache
+{
+public:
+    HEADER Header;
+    // owned by the writer, null once unpinned
+    std::shared_ptr<TableBlocks> pinned;
+    // what readers see of pinned, valid as long as their version is
+    std::atomic<TableBlocks *> blocks;
+    vector<range> RangeDel;
+    uint32_t dataEnd;
+    uint64_t fileSize;
+    uint64_t maxSeq;
+    // point tombstones with no older version of their key in the table,
+    // the ones compaction into the bottom level can drop
+    uint64_t tombstones;
+    bool obsolete;
+    std::string path;
+    std::shared_ptr<MappedFile> mapping;
+    // kept in memory like the header, null for tables written without one
+    std::shared_ptr<RangeFilter> rangeFilter;
+    // the top level of a partitioned table, its partitions are read
+    // through blockCache on demand; null when the whole index is loaded
+    std::shared_ptr<IndexPartitions> partitions;
+    BlockCache *blockCache;
+    // where the filter and index of an unpinned table are kept between
+    // lookups, null to read them for each one
+    BlockCache *unpinnedCache;
+    // names the table in the block cache, shared by its links
+    uint64_t id;
+    // where the checksums of the values start, 0 for tables written without
+    uint64_t crcOffset;
+    // orders tables by when all of their bytes were last checked, tables
+    // opened from disk have never been
+    std::atomic<uint64_t> verified;
+    MemoryBudget *budget;
+    SSTableCache();
+    // with a block cache a partitioned table keeps only its top level
+    SSTableCache(const std::string &dir, BlockCache *blockCache = nullptr);
+    // without fill a miss is not put in the cache, for reads of tables about to go
+    std::shared_ptr<TableBlocks> acquire(Statistics *stats = nullptr, bool fill = true);
+    std::shared_ptr<TableBlocks> unpin(BlockCache *cache);
+    void setBudget(MemoryBudget *budget);
+    void setBlockCache(BlockCache *blockCache);
+    int search(uint64_t key, uint64_t seq, std::shared_ptr<TableBlocks> &held, Statistics *stats = nullptr);
+    int lowpos(uint64_t key1, uint64_t key2, std::shared_ptr<TableBlocks> &held, Statistics *stats = nullptr);
+    // a scan past the end of held goes on in the next partition, if any
+    bool nextBlocks(std::shared_ptr<TableBlocks> &held, Statistics *stats = nullptr);
+    uint32_t valueLength(const TableBlocks *held, int pos);
+    // exits like a failed read if data, read for index, is not the value written
+    void checkValue(const INDEX &index, const char *data, uint32_t length) const;
+    // read the whole file back and check every checksum, false if one fails
+    bool verify(RateLimiter *limiter = nullptr);
+    SSTableCache *relink(const std::string &dir);
+    ~SSTableCache();
+
+private:
+    std::shared_ptr<TableBlocks> load(bool all, bool index = true);
+    std::shared_ptr<TableBlocks> partition(uint32_t p, Statistics *stats);
+    std::shared_ptr<TableBlocks> readPartition(uint32_t p);
+    int find(const vector<INDEX> &Index, uint64_t key, int lo, int hi, uint32_t &steps);
+    int find2(const vector<INDEX> &Index, int lo, int hi, uint64_t key1, uint64_t key2, uint32_t &steps);
+};
+
+class SSTable
+{
+public:
+    uint64_t timeStamp;
+    std::string path;
+    uint64_t size;
+    uint64_t length;
+    std::list<ENTRY> Entries;
+    std::vector<range> RangeDel;
+    SSTable(SSTableCache *cache, RateLimiter *limiter = nullptr, uint64_t lo = 0, uint64_t hi = UINT64_MAX);
+    SSTable() : timeStamp(0), size(10272 + FOOTER_SIZE), length(0) {}
+    std::vector<SSTableCache *> save(const std::string &dir, const TableWriteOptions &options = TableWriteOptions(), uint64_t firstNum = 0, uint64_t numStep = 1);
+    static void merge(std::vector<SSTable> &tables);
+    static SSTable merge2(SSTable &a, SSTable &b);
+    void purge(const std::multiset<uint64_t> &snapshots, bool bottom);
+    void add(ENTRY &);
+    void addRangeDel(const std::vector<range> &ranges);
+    SSTableCache *saveSingle(const std::string &dir, const uint64_t &currentTime, const uint64_t &num, const TableWriteOptions &options = TableWriteOptions(),
+                             uint64_t numStep = 1);
+};
+
+bool cacheTimeCompare(const std::shared_ptr<SSTableCache> &a, const std::shared_ptr<SSTableCache> &b);
+bool haveIntersection(const SSTableCache *cache, const std::vector<range> &ranges);
+bool disjointRanges(std::vector<range> ranges);
+bool tableTimecompare(SSTable &a, SSTable &b);
+uint64_t coveringSeq(const std::vector<range> &ranges, uint64_t key, uint64_t seq);
+uint64_t containingSeq(const std::vector<range> &ranges, uint64_t min, uint64_t max);
+uint64_t hiddenSeq(const std::vector<range> &ranges, uint64_t key, uint64_t seq);
+bool snapshotBetween(const std::multiset<uint64_t> &snapshots, uint64_t lo, uint64_t hi);
+bool needVersion(uint64_t seq, uint64_t hideSeq, const std::multiset<uint64_t> &snapshots);
+uint64_t metaSize(const std::vector<range> &rangeDel, uint64_t num, const TableWriteOptions &options = TableWriteOptions());
+uint64_t saveMeta(char *meta, uint64_t metaOffset, const std::vector<INDEX> &index, const std::vector<range> &rangeDel, uint64_t tombstones,
+                  uint32_t headCrc, const RangeFilter *rangeFilter = nullptr, const TableWriteOptions &options = TableWriteOptions());
+#endif // SSTABLE_H
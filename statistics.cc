@@ -0,0 +1,212 @@
+#include "statistics.h"
+#include <chrono>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+const uint32_t Statistics::SHARDS;
+const uint32_t Statistics::SUB_BUCKET_BITS;
+const uint32_t Statistics::MAX_EXPONENT;
+const uint32_t Statistics::BUCKETS;
+
+static const char *tickerNames[TICKER_COUNT] = {
+    "get.hit.memtable",
+    "get.hit.l0",
+    "get.hit.l1",
+    "get.hit.l2",
+    "get.hit.l3",
+    "get.hit.l4",
+    "get.hit.l5",
+    "get.hit.l6+",
+    "get.miss",
+    "bloom.useful",
+    "bloom.false.positive",
+    "bloom.true.positive",
+    "rangefilter.useful",
+    "keys.written",
+    "keys.read",
+    "bytes.written",
+    "bytes.read",
+    "table.bytes.read",
+    "rowcache.hit",
+    "rowcache.miss",
+    "blockcache.hit",
+    "blockcache.miss",
+    "flush.count",
+    "flush.bytes.written",
+    "compaction.count",
+    "compaction.trivial.move",
+    "compaction.bytes.read",
+    "compaction.bytes.written",
+    "scrub.tables",
+    "scrub.bytes.read",
+    "scrub.corrupt.tables"};
+
+static const char *histogramNames[HISTOGRAM_COUNT] = {
+    "put",
+    "get",
+    "scan",
+    "del",
+    "flush",
+    "compaction"};
+
+uint64_t nowNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Statistics::Statistics() : shards(new Shard[SHARDS])
+{
+    reset();
+}
+
+Statistics::Shard &Statistics::local()
+{
+    // threads are spread over the shards in the order they first record
+    static std::atomic<uint32_t> nextSlot(0);
+    static thread_local uint32_t slot = nextSlot.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+    return shards[slot];
+}
+
+uint32_t Statistics::bucketOf(uint64_t value)
+{
+    if (value < (1ULL << SUB_BUCKET_BITS))
+        return value;
+    uint32_t exponent = 63 - __builtin_clzll(value);
+    if (exponent >= MAX_EXPONENT)
+        return BUCKETS - 1;
+    uint32_t sub = (value >> (exponent - SUB_BUCKET_BITS)) & ((1U << SUB_BUCKET_BITS) - 1);
+    return ((exponent - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS) + sub;
+}
+
+// the largest value that falls into bucket
+uint64_t Statistics::bucketLimit(uint32_t bucket)
+{
+    if (bucket < (1U << SUB_BUCKET_BITS))
+        return bucket;
+    uint32_t exponent = (bucket >> SUB_BUCKET_BITS) + SUB_BUCKET_BITS - 1;
+    uint64_t sub = bucket & ((1U << SUB_BUCKET_BITS) - 1);
+    uint64_t width = 1ULL << (exponent - SUB_BUCKET_BITS);
+    return (((1ULL << SUB_BUCKET_BITS) + sub) << (exponent - SUB_BUCKET_BITS)) + width - 1;
+}
+
+void Statistics::recordTick(Ticker ticker, uint64_t count)
+{
+    local().tickers[ticker].fetch_add(count, std::memory_order_relaxed);
+}
+
+void Statistics::measureTime(Histogram histogram, uint64_t nanos)
+{
+    Shard &shard = local();
+    shard.buckets[histogram][bucketOf(nanos)].fetch_add(1, std::memory_order_relaxed);
+    shard.sums[histogram].fetch_add(nanos, std::memory_order_relaxed);
+    uint64_t max = shard.maxs[histogram].load(std::memory_order_relaxed);
+    while (nanos > max && !shard.maxs[histogram].compare_exchange_weak(max, nanos, std::memory_order_relaxed))
+        ;
+}
+
+uint64_t Statistics::getTickerCount(Ticker ticker) const
+{
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < SHARDS; ++i)
+        count += shards[i].tickers[ticker].load(std::memory_order_relaxed);
+    return count;
+}
+
+HistogramData Statistics::getHistogramData(Histogram histogram) const
+{
+    HistogramData data;
+    data.count = data.sum = data.max = 0;
+    std::vector<uint64_t> buckets(BUCKETS, 0);
+    for (uint32_t i = 0; i < SHARDS; ++i)
+    {
+        const Shard &shard = shards[i];
+        for (uint32_t j = 0; j < BUCKETS; ++j)
+        {
+            uint64_t n = shard.buckets[histogram][j].load(std::memory_order_relaxed);
+            buckets[j] += n;
+            data.count += n;
+        }
+        data.sum += shard.sums[histogram].load(std::memory_order_relaxed);
+        data.max = std::max(data.max, shard.maxs[histogram].load(std::memory_order_relaxed));
+    }
+    data.mean = data.count ? (double)data.sum / data.count : 0;
+    double *percentiles[] = {&data.p50, &data.p95, &data.p99, &data.p999};
+    double ranks[] = {0.5, 0.95, 0.99, 0.999};
+    for (uint32_t k = 0; k < 4; ++k)
+    {
+        uint64_t rank = (uint64_t)(ranks[k] * data.count + 0.5);
+        uint64_t seen = 0;
+        *percentiles[k] = 0;
+        for (uint32_t j = 0; j < BUCKETS && data.count > 0; ++j)
+        {
+            seen += buckets[j];
+            if (seen >= std::max<uint64_t>(rank, 1))
+            {
+                *percentiles[k] = std::min(bucketLimit(j), data.max);
+                break;
+            }
+        }
+    }
+    return data;
+}
+
+void Statistics::reset()
+{
+    for (uint32_t i = 0; i < SHARDS; ++i)
+    {
+        Shard &shard = shards[i];
+        for (uint32_t j = 0; j < TICKER_COUNT; ++j)
+            shard.tickers[j].store(0, std::memory_order_relaxed);
+        for (uint32_t j = 0; j < HISTOGRAM_COUNT; ++j)
+        {
+            shard.sums[j].store(0, std::memory_order_relaxed);
+            shard.maxs[j].store(0, std::memory_order_relaxed);
+            for (uint32_t k = 0; k < BUCKETS; ++k)
+                shard.buckets[j][k].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+const char *Statistics::tickerName(Ticker ticker)
+{
+    return tickerNames[ticker];
+}
+
+const char *Statistics::histogramName(Histogram histogram)
+{
+    return histogramNames[histogram];
+}
+
+std::string Statistics::toString() const
+{
+    std::ostringstream out;
+    for (uint32_t i = 0; i < TICKER_COUNT; ++i)
+        out << tickerNames[i] << " COUNT : " << getTickerCount((Ticker)i) << "\n";
+    out << std::fixed << std::setprecision(2);
+    for (uint32_t i = 0; i < HISTOGRAM_COUNT; ++i)
+    {
+        HistogramData data = getHistogramData((Histogram)i);
+        // latencies are kept in nanoseconds and shown in microseconds
+        out << histogramNames[i] << ".micros P50 : " << data.p50 / 1000 << " P95 : " << data.p95 / 1000
+            << " P99 : " << data.p99 / 1000 << " P99.9 : " << data.p999 / 1000 << " MAX : " << data.max / 1000.0
+            << " COUNT : " << data.count << " MEAN : " << data.mean / 1000 << "\n";
+    }
+    return out.str();
+}
+
+StopWatch::StopWatch(Statistics *stats, Histogram histogram) : stats(stats), histogram(histogram), start(nowNanos())
+{
+}
+
+StopWatch::~StopWatch()
+{
+    if (stats)
+        stats->measureTime(histogram, elapsed());
+}
+
+uint64_t StopWatch::elapsed() const
+{
+    return nowNanos() - start;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <string>
+
+// gets served by levels this deep or deeper share the last hit counter
+#define STATS_LEVELS 7
+
+enum Ticker
+{
+	GET_HIT_MEMTABLE = 0,
+	GET_HIT_L0,
+	GET_MISS = GET_HIT_L0 + STATS_LEVELS,
+	// filter said no and the table was skipped
+	BLOOM_USEFUL,
+	// filter said maybe but the table has no version of the key
+	BLOOM_FALSE_POSITIVE,
+	BLOOM_TRUE_POSITIVE,
+	// range filter said no and a scan skipped the table
+	RANGE_FILTER_USEFUL,
+	KEYS_WRITTEN,
+	KEYS_READ,
+	// key and value bytes handed in by put / returned by get and scan
+	BYTES_WRITTEN,
+	BYTES_READ,
+	// value bytes read from table files by get and scan
+	TABLE_BYTES_READ,
+	// gets past the memtable answered by the row cache or not
+	ROW_CACHE_HIT,
+	ROW_CACHE_MISS,
+	// index partitions found in the block cache or read from the table
+	BLOCK_CACHE_HIT,
+	BLOCK_CACHE_MISS,
+	FLUSH_COUNT,
+	FLUSH_BYTES_WRITTEN,
+	COMPACTION_COUNT,
+	TRIVIAL_MOVE_COUNT,
+	COMPACT_BYTES_READ,
+	COMPACT_BYTES_WRITTEN,
+	// tables read back whole by the scrubber, and those failing their checksums
+	TABLES_SCRUBBED,
+	SCRUB_BYTES_READ,
+	SCRUB_CORRUPT_TABLES,
+	TICKER_COUNT
+};
+
+enum Histogram
+{
+	PUT_LATENCY = 0,
+	GET_LATENCY,
+	SCAN_LATENCY,
+	DEL_LATENCY,
+	FLUSH_LATENCY,
+	COMPACTION_LATENCY,
+	HISTOGRAM_COUNT
+};
+
+struct HistogramData
+{
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	double mean, p50, p95, p99, p999;
+};
+
+/**
+ * Counters and latency distributions of one store. Histograms hold
+ * nanoseconds in log-linear buckets, 16 per power of two, so any
+ * percentile is off by at most 1/16 of its value.
+ * Updates are relaxed atomic adds on a shard picked per thread, so
+ * writers and readers never contend on a lock or on one cache line.
+ * Reads sum up all shards and may miss updates still in flight.
+ */
+class Statistics
+{
+private:
+	static const uint32_t SHARDS = 8;
+	static const uint32_t SUB_BUCKET_BITS = 4;
+	static const uint32_t MAX_EXPONENT = 40;
+	static const uint32_t BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+	struct Shard
+	{
+		std::atomic<uint64_t> tickers[TICKER_COUNT];
+		std::atomic<uint64_t> sums[HISTOGRAM_COUNT];
+		std::atomic<uint64_t> maxs[HISTOGRAM_COUNT];
+		std::atomic<uint64_t> buckets[HISTOGRAM_COUNT][BUCKETS];
+		char padding[64];
+	};
+
+	std::unique_ptr<Shard[]> shards;
+
+	Shard &local();
+	static uint32_t bucketOf(uint64_t value);
+	static uint64_t bucketLimit(uint32_t bucket);
+
+public:
+	Statistics();
+
+	void recordTick(Ticker ticker, uint64_t count = 1);
+
+	void measureTime(Histogram histogram, uint64_t nanos);
+
+	uint64_t getTickerCount(Ticker ticker) const;
+
+	HistogramData getHistogramData(Histogram histogram) const;
+
+	void reset();
+
+	static const char *tickerName(Ticker ticker);
+
+	static const char *histogramName(Histogram histogram);
+
+	std::string toString() const;
+};
+
+/**
+ * Adds the time from its construction to its destruction to a histogram.
+ */
+class StopWatch
+{
+private:
+	Statistics *stats;
+	Histogram histogram;
+	uint64_t start;
+
+public:
+	StopWatch(Statistics *stats, Histogram histogram);
+	~StopWatch();
+	uint64_t elapsed() const;
+};
+
+uint64_t nowNanos();
@@ -0,0 +1,341 @@
+#include "tablebuilder.h"
+#include "utils.h"
+#include "crc32c.h"
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <malloc.h>
+#endif
+
+const uint64_t TableBuilder::ALIGNMENT;
+const uint64_t TableBuilder::BUFFER_SIZE;
+
+static uint64_t alignUp(uint64_t size, uint64_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+// buffers written with O_DIRECT must sit at aligned addresses
+static char *allocAligned(uint64_t size, uint64_t alignment)
+{
+#ifdef _WIN32
+    return (char *)_aligned_malloc(size, alignment);
+#else
+    void *ptr = nullptr;
+    if (posix_memalign(&ptr, alignment, size) != 0)
+        return nullptr;
+    return (char *)ptr;
+#endif
+}
+
+static void freeAligned(char *ptr)
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+static int openTable(const std::string &path, bool &direct)
+{
+#ifdef _WIN32
+    direct = false;
+    return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    if (direct)
+    {
+        int fd = open(path.c_str(), flags | O_DIRECT, 0644);
+        if (fd >= 0)
+            return fd;
+    }
+#endif
+    // the file system may not take direct I/O, the page cache will do
+    direct = false;
+    return open(path.c_str(), flags, 0644);
+#endif
+}
+
+static int64_t writeFile(int fd, const char *data, uint64_t size, uint64_t pos)
+{
+#ifdef _WIN32
+    if (_lseeki64(fd, pos, SEEK_SET) < 0)
+        return -1;
+    return _write(fd, data, size);
+#else
+    return pwrite(fd, data, size, pos);
+#endif
+}
+
+#ifndef _WIN32
+// the new name is only durable once the directory holding it is synced
+static void syncDir(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash);
+    int dirFd = open(dir.c_str(), O_RDONLY);
+    if (dirFd < 0 || fsync(dirFd) != 0)
+    {
+        printf("Fail to write file %s", path.c_str());
+        exit(-1);
+    }
+    close(dirFd);
+}
+#endif
+
+TableBuilder::TableBuilder(const std::string &path, uint64_t num, uint64_t fileSize, IOPriority priority,
+                           const TableWriteOptions &options)
+    : options(options), priority(priority), num(num), count(0), lastKey(0), lastDeleted(false)
+{
+    cache = new SSTableCache();
+    cache->path = path;
+    blocks = cache->pinned.get();
+    blocks->Index.reserve(num);
+    offset = 10272 + 12 * num;
+    headSize = alignUp(offset, ALIGNMENT);
+    head = allocAligned(headSize, ALIGNMENT);
+    buffer = allocAligned(BUFFER_SIZE, ALIGNMENT);
+    memset(head, 0, headSize);
+    bufferStart = headSize;
+    used = 0;
+    synced = headSize;
+    direct = options.directWrites;
+    fd = openTable(path, direct);
+    if (fd < 0 || !head || !buffer)
+    {
+        printf("Fail to open file %s", path.c_str());
+        exit(-1);
+    }
+#ifdef __linux__
+    // reserve the extents at once, the size is set when the table is done
+    // a file system without fallocate just grows the file as it is written
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, fileSize) != 0 && errno != EOPNOTSUPP && errno != ENOSYS)
+    {
+        printf("Fail to write file %s", path.c_str());
+        exit(-1);
+    }
+#else
+    (void)fileSize;
+#endif
+}
+
+TableBuilder::~TableBuilder()
+{
+    // a table that was never finished is removed
+    if (fd >= 0)
+    {
+        close(fd);
+        utils::rmfile(cache->path.c_str());
+    }
+    delete cache;
+    freeAligned(head);
+    freeAligned(buffer);
+}
+
+void TableBuilder::add(uint64_t key, uint64_t seq, const std::string &value)
+{
+    if (count == num)
+    {
+        printf("Buffer Overflow!!!\n");
+        exit(-1);
+    }
+    // point tombstones with no older version of their key in the table
+    if (lastDeleted && key != lastKey)
+        cache->tombstones++;
+    lastDeleted = value == "~DELETED~";
+    lastKey = key;
+    blocks->BF->setBF(key);
+    blocks->Index.push_back(INDEX(key, offset, seq, crc32c::value(value.data(), value.size())));
+    char *index = head + 10272 + 12 * count;
+    *(uint64_t *)index = key;
+    *(uint32_t *)(index + 8) = offset;
+    ++count;
+    if (seq > cache->maxSeq)
+        cache->maxSeq = seq;
+    append(value.data(), value.size());
+}
+
+void TableBuilder::append(const char *data, uint64_t size)
+{
+    while (size > 0)
+    {
+        uint64_t n;
+        if (offset < headSize)
+        {
+            n = min(size, headSize - offset);
+            memcpy(head + offset, data, n);
+        }
+        else
+        {
+            n = min(size, BUFFER_SIZE - used);
+            memcpy(buffer + used, data, n);
+            used += n;
+        }
+        offset += n;
+        data += n;
+        size -= n;
+        if (used == BUFFER_SIZE)
+            writeBuffer();
+    }
+}
+
+void TableBuilder::writeBuffer()
+{
+    // a direct write of the last, partial buffer is padded and cut off later
+    writeAt(buffer, direct ? alignUp(used, ALIGNMENT) : used, bufferStart);
+    bufferStart += used;
+    used = 0;
+#ifdef __linux__
+    // start writing back in the background, so the final sync finds little
+    // left to do and the page cache never holds a whole table of dirty pages
+    if (options.bytesPerSync > 0 && bufferStart - synced >= options.bytesPerSync)
+    {
+        sync_file_range(fd, synced, bufferStart - synced, SYNC_FILE_RANGE_WRITE);
+        synced = bufferStart;
+    }
+#endif
+}
+
+void TableBuilder::writeAt(const char *data, uint64_t size, uint64_t pos)
+{
+    // in pieces no larger than what the limiter grants at once
+    for (uint64_t done = 0; options.rateLimiter && done < size; done += BUFFER_SIZE)
+        options.rateLimiter->request(min(BUFFER_SIZE, size - done), priority);
+    while (size > 0)
+    {
+        int64_t n = writeFile(fd, data, size, pos);
+#if defined(O_DIRECT) && !defined(_WIN32)
+        if (n < 0 && errno == EINVAL && direct)
+        {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            direct = false;
+            continue;
+        }
+#endif
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            printf("Fail to write file %s", cache->path.c_str());
+            exit(-1);
+        }
+        data += n;
+        size -= n;
+        pos += n;
+    }
+}
+
+SSTableCache *TableBuilder::finish(uint64_t timestamp, const std::vector<range> &rangeDel)
+{
+    if (count != num)
+    {
+        printf("Table %s ends after %llu of %llu entries\n", cache->path.c_str(), (unsigned long long)count, (unsigned long long)num);
+        exit(-1);
+    }
+    if (lastDeleted)
+        cache->tombstones++;
+    HEADER &header = cache->Header;
+    header.timestamp = timestamp;
+    header.num = num;
+    header.min = UINT64_MAX;
+    header.max = 0;
+    if (num > 0)
+    {
+        header.min = blocks->Index.front().Key;
+        header.max = blocks->Index.back().Key;
+    }
+    // range tombstones widen the key span so compaction pulls in what they cover
+    for (auto it = rangeDel.begin(); it != rangeDel.end(); ++it)
+    {
+        if ((*it).min < header.min)
+            header.min = (*it).min;
+        if ((*it).max > header.max)
+            header.max = (*it).max;
+        if ((*it).seq > cache->maxSeq)
+            cache->maxSeq = (*it).seq;
+    }
+    cache->dataEnd = offset;
+    uint32_t rangeFilterBits = num > 0 ? options.rangeFilterBitsPerKey : 0;
+    if (rangeFilterBits > 0)
+    {
+        std::vector<uint64_t> keys;
+        keys.reserve(num);
+        for (auto it = blocks->Index.begin(); it != blocks->Index.end(); ++it)
+            keys.push_back((*it).Key);
+        cache->rangeFilter = std::make_shared<RangeFilter>(keys, rangeFilterBits);
+    }
+    // the head is complete but for data, its checksum goes with the meta blocks
+    *(uint64_t *)head = header.timestamp;
+    *(uint64_t *)(head + 8) = header.num;
+    *(uint64_t *)(head + 16) = header.min;
+    *(uint64_t *)(head + 24) = header.max;
+    blocks->BF->saveBuffer(head + 32);
+    uint32_t headCrc = crc32c::value(head, 10272 + 12 * num);
+    char *meta = new char[metaSize(rangeDel, num, options) + FOOTER_SIZE];
+    uint64_t metaBytes = saveMeta(meta, offset, blocks->Index, rangeDel, cache->tombstones, headCrc, cache->rangeFilter.get(), options);
+    // the top level of the index partitions, for a store that reads them on
+    // demand, the filter readers keep in place of the fixed one, and where
+    // the checksums readers check values and partitions against are
+    for (uint64_t pos = 0; pos + 8 <= metaBytes - FOOTER_SIZE;)
+    {
+        uint32_t type = *(uint32_t *)(meta + pos), blockSize = *(uint32_t *)(meta + pos + 4);
+        if (type == INDEX_PARTITIONS_BLOCK)
+            cache->partitions = std::make_shared<IndexPartitions>(meta + pos + 8, blockSize);
+        else if (type == FILTER_BLOCK)
+            blocks->filter.reset(new FilterBlock(meta + pos + 8, blockSize));
+        else if (type == CHECKSUM_BLOCK)
+        {
+            const uint32_t *crcs = (const uint32_t *)(meta + pos + 8 + 16) + *(uint32_t *)(meta + pos + 16);
+            cache->crcOffset = offset + (const char *)crcs - meta;
+            if (cache->partitions)
+                cache->partitions->crcs.assign(crcs + num, crcs + num + cache->partitions->count());
+        }
+        pos += 8 + blockSize;
+    }
+    append(meta, metaBytes);
+    delete[] meta;
+    uint64_t fileSize = offset;
+    if (used > 0)
+        writeBuffer();
+
+    if (blocks->filter)
+        blocks->BF.reset();
+    writeAt(head, direct ? headSize : min(headSize, fileSize), 0);
+
+#ifdef _WIN32
+    _chsize_s(fd, fileSize);
+    _commit(fd);
+    _close(fd);
+#else
+    if (ftruncate(fd, fileSize) != 0)
+    {
+        printf("Fail to write file %s", cache->path.c_str());
+        exit(-1);
+    }
+#ifdef __linux__
+    int ret = fdatasync(fd);
+#else
+    int ret = fsync(fd);
+#endif
+    if (ret != 0)
+    {
+        printf("Fail to write file %s", cache->path.c_str());
+        exit(-1);
+    }
+    close(fd);
+    syncDir(cache->path);
+#endif
+    fd = -1;
+    cache->RangeDel = rangeDel;
+    cache->fileSize = fileSize;
+    cache->mapping = MappedFile::map(cache->path, fileSize);
+    SSTableCache *table = cache;
+    cache = nullptr;
+    return table;
+}
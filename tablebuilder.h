@@ -0,0 +1,55 @@
+#pragma once
+
+#include "sstable.h"
+#include <string>
+#include <vector>
+
+/**
+ * Writes one table front to back without holding the file in memory.
+ * Values go out through an aligned buffer as they are added; the header,
+ * filter and index in front of them are known only at the end and are
+ * written last. The number of entries must be known up front to place
+ * the data. finish() syncs the file, so the returned table can be
+ * installed right away.
+ */
+class TableBuilder
+{
+private:
+	static const uint64_t ALIGNMENT = 4096;
+	static const uint64_t BUFFER_SIZE = 256 * 1024;
+
+	TableWriteOptions options;
+	IOPriority priority;
+	SSTableCache *cache;
+	TableBlocks *blocks;
+	int fd;
+	bool direct;
+	uint64_t num;
+	uint64_t count;
+	uint64_t lastKey;
+	bool lastDeleted;
+	// next byte of the file to be appended
+	uint64_t offset;
+	// header, filter, index and the first data bytes, up to an aligned end
+	char *head;
+	uint64_t headSize;
+	// the data from bufferStart on
+	char *buffer;
+	uint64_t bufferStart;
+	uint64_t used;
+	uint64_t synced;
+
+	void append(const char *data, uint64_t size);
+	void writeBuffer();
+	void writeAt(const char *data, uint64_t size, uint64_t pos);
+
+public:
+	TableBuilder(const std::string &path, uint64_t num, uint64_t fileSize, IOPriority priority,
+				 const TableWriteOptions &options = TableWriteOptions());
+	~TableBuilder();
+
+	// keys ascending, versions of a key newest first
+	void add(uint64_t key, uint64_t seq, const std::string &value);
+
+	SSTableCache *finish(uint64_t timestamp, const std::vector<range> &rangeDel);
+};
@@ -156,4 +156,19 @@ namespace utils
 #endif
     }
 
+    /**
+     * Give a file a second name
+     * @param from existing file.
+     * @param to new name, must not exist yet.
+     * @return 0 if linked successfully, -1 otherwise.
+     */
+    static inline int link(const char *from, const char *to)
+    {
+#ifdef _WIN32
+        return CreateHardLinkA(to, from, NULL) ? 0 : -1;
+#else
+        return ::link(from, to);
+#endif
+    }
+
 }